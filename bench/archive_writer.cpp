@@ -0,0 +1,244 @@
+#include "stdafx.h"
+
+#include "archive_writer.h"
+
+#include "downloadunzip/zip_format.h"
+
+namespace {
+
+constexpr std::size_t kBufferSize = 0x100000;  // 1 MiB
+// 2020-01-01 00:00:00, fixed so archives come out the same
+constexpr std::uint16_t kDosDate = (40 << 9) | (1 << 5) | 1;
+constexpr std::uint16_t kDosTime = 0;
+constexpr std::uint16_t kVersion = 20;  // deflate
+constexpr std::size_t kMaxEntries = 0xffff;
+
+constexpr PCSTR kWords[] = {
+    "auto",     "bool",   "break",   "case",    "char",     "class",
+    "const",    "return", "default", "delete",  "do",       "double",
+    "else",     "enum",   "false",   "float",   "for",      "if",
+    "inline",   "int",    "long",    "new",     "nullptr",  "operator",
+    "private",  "public", "size",    "static",  "std::",    "struct",
+    "switch",   "this",   "true",    "typedef", "unsigned", "using",
+    "virtual",  "void",   "while",   "{",       "}",        "(",
+    ")",        ";",      "=",       "==",      "<",        ">",
+    "->",       "ptr",    "data",    "offset",  "buffer",   "entry",
+    "archive",  "stream", "header",  "result",  "options",  "count",
+    "uint64_t", "//",     "#include", "0",
+};
+
+// xorshift64*, fast enough not to show next to deflate
+class Generator {
+ public:
+  Generator(Content content, std::uint64_t seed)
+      : content_{content}, state_{seed * 0x9e3779b97f4a7c15 | 1} {}
+
+  void Fill(PBYTE ptr, std::size_t size) {
+    if (content_ == Content::kRandom) {
+      for (; sizeof(std::uint64_t) <= size; size -= sizeof(std::uint64_t)) {
+        auto value = Next();
+        std::memcpy(ptr, &value, sizeof(std::uint64_t));
+        ptr += sizeof(std::uint64_t);
+      }
+      auto value = Next();
+      std::memcpy(ptr, &value, size);
+      return;
+    }
+    for (; size; --size) {
+      if (*word_) {
+        *ptr++ = *word_++;
+        continue;
+      }
+      *ptr++ = separator_;
+      auto value = Next();
+      word_ = kWords[value % std::size(kWords)];
+      // one line in 16 words
+      separator_ = value >> 60 ? ' ' : '\n';
+    }
+  }
+
+ private:
+  std::uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545f4914f6cdd1d;
+  }
+
+  Content content_;
+  std::uint64_t state_;
+  PCSTR word_{""};  // rest of the word being written
+  char separator_{'\n'};
+};
+
+}  // namespace
+
+ArchiveWriter::~ArchiveWriter() {
+  if (deflating_) deflateEnd(&strm_);
+  if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+}
+
+bool ArchiveWriter::Initialize(PCSTR path) {
+  assert(file_ == INVALID_HANDLE_VALUE);
+  path_ = path;
+  file_ = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    std::cerr << "error creating archive " << path << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  in_.reset(new BYTE[kBufferSize]);
+  out_.reset(new BYTE[kBufferSize]);
+  return true;
+}
+
+bool ArchiveWriter::Add(PCSTR name, std::uint32_t size, bool deflate,
+                        Content content, std::uint64_t seed) {
+  if (kMaxEntries <= entries_.size() || UINT32_MAX < offset_) {
+    std::cerr << "archive " << path_ << " needs ZIP64" << std::endl;
+    return false;
+  }
+  Entry entry{name, static_cast<std::uint16_t>(deflate ? 8 : 0), 0, 0, size,
+              static_cast<std::uint32_t>(offset_)};
+  if (deflate) {
+    auto res = deflating_ ? deflateReset(&strm_)
+                          : deflateInit2(&strm_, Z_DEFAULT_COMPRESSION,
+                                         Z_DEFLATED, -MAX_WBITS, 8,
+                                         Z_DEFAULT_STRATEGY);
+    if (res != Z_OK) {
+      std::cerr << "error initializing zlib (code " << res << ')'
+                << std::endl;
+      return false;
+    }
+    deflating_ = true;
+  }
+  LocalFileHeader header{};
+  header.version_needed_to_extract = kVersion;
+  header.compression_method = entry.method;
+  header.last_mod_file_time = kDosTime;
+  header.last_mod_file_date = kDosDate;
+  header.uncompressed_size = size;
+  header.file_name_length = static_cast<std::uint16_t>(entry.name.size());
+  auto signature = LocalFileHeader::kSignature;
+  auto ok = Write(&signature, sizeof(std::uint32_t)) &&
+            Write(&header, sizeof(LocalFileHeader)) &&
+            Write(entry.name.data(), entry.name.size());
+  if (!ok) return false;
+  auto begin = offset_;
+  Generator generator{content, seed};
+  auto crc = crc32(0, Z_NULL, 0);
+  auto left = size;
+  do {  // an empty entry still ends its deflate stream
+    auto chunk = static_cast<std::size_t>((std::min)(
+        static_cast<std::size_t>(left), kBufferSize));
+    generator.Fill(in_.get(), chunk);
+    crc = crc32(crc, in_.get(), static_cast<uInt>(chunk));
+    left -= static_cast<std::uint32_t>(chunk);
+    ok = deflate ? Deflate(in_.get(), chunk, !left) : Write(in_.get(), chunk);
+    if (!ok) return false;
+  } while (left);
+  if (UINT32_MAX < offset_ - begin) {
+    std::cerr << "archive " << path_ << " needs ZIP64" << std::endl;
+    return false;
+  }
+  entry.crc32 = static_cast<std::uint32_t>(crc);
+  entry.compressed_size = static_cast<std::uint32_t>(offset_ - begin);
+  // crc and compressed size are known once the data is written
+  header.crc32 = entry.crc32;
+  header.compressed_size = entry.compressed_size;
+  if (!WriteAt(entry.offset + sizeof(std::uint32_t), &header,
+               sizeof(LocalFileHeader)))
+    return false;
+  entries_.push_back(std::move(entry));
+  return true;
+}
+
+bool ArchiveWriter::Finish() {
+  auto begin = offset_;
+  for (auto& entry : entries_) {
+    CentralDirectoryHeader header{};
+    header.version_made_by = kVersion;
+    header.version_needed_to_extract = kVersion;
+    header.compression_method = entry.method;
+    header.last_mod_file_time = kDosTime;
+    header.last_mod_file_date = kDosDate;
+    header.crc32 = entry.crc32;
+    header.compressed_size = entry.compressed_size;
+    header.uncompressed_size = entry.uncompressed_size;
+    header.file_name_length = static_cast<std::uint16_t>(entry.name.size());
+    header.relative_offset_of_local_header = entry.offset;
+    auto signature = CentralDirectoryHeader::kSignature;
+    auto ok = Write(&signature, sizeof(std::uint32_t)) &&
+              Write(&header, sizeof(CentralDirectoryHeader)) &&
+              Write(entry.name.data(), entry.name.size());
+    if (!ok) return false;
+  }
+  if (UINT32_MAX < offset_) {
+    std::cerr << "archive " << path_ << " needs ZIP64" << std::endl;
+    return false;
+  }
+  EndOfCentralDirectoryRecord record{};
+  auto count = static_cast<std::uint16_t>(entries_.size());
+  record.total_number_of_entries_in_the_central_directory_on_this_disk = count;
+  record.total_number_of_entries_in_the_central_directory = count;
+  record.size_of_the_central_directory =
+      static_cast<std::uint32_t>(offset_ - begin);
+  record
+      .offset_of_start_of_central_directory_with_respect_to_the_starting_disk_number =
+      static_cast<std::uint32_t>(begin);
+  auto signature = EndOfCentralDirectoryRecord::kSignature;
+  auto ok = Write(&signature, sizeof(std::uint32_t)) &&
+            Write(&record, sizeof(EndOfCentralDirectoryRecord));
+  if (!ok) return false;
+  CloseHandle(file_);
+  file_ = INVALID_HANDLE_VALUE;
+  return true;
+}
+
+bool ArchiveWriter::Write(const void* ptr, std::size_t size) {
+  DWORD written = 0;
+  if (!WriteFile(file_, ptr, static_cast<DWORD>(size), &written, NULL) ||
+      written != size) {
+    auto error = GetLastError();
+    std::cerr << "error writing archive " << path_ << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  offset_ += size;
+  return true;
+}
+
+bool ArchiveWriter::WriteAt(std::uint64_t offset, const void* ptr,
+                            std::size_t size) {
+  LARGE_INTEGER position{};
+  position.QuadPart = static_cast<LONGLONG>(offset);
+  if (SetFilePointerEx(file_, position, NULL, FILE_BEGIN)) {
+    DWORD written = 0;
+    auto ok =
+        WriteFile(file_, ptr, static_cast<DWORD>(size), &written, NULL) &&
+        written == size;
+    position.QuadPart = static_cast<LONGLONG>(offset_);
+    if (ok && SetFilePointerEx(file_, position, NULL, FILE_BEGIN))
+      return true;
+  }
+  auto error = GetLastError();
+  std::cerr << "error writing archive " << path_ << " (code " << error << ')'
+            << std::endl;
+  return false;
+}
+
+bool ArchiveWriter::Deflate(const BYTE* ptr, std::size_t size, bool flush) {
+  strm_.next_in = const_cast<BYTE*>(ptr);
+  strm_.avail_in = static_cast<uInt>(size);
+  auto res = Z_OK;
+  do {  // until the input is taken, and the stream ended if flushing
+    strm_.next_out = out_.get();
+    strm_.avail_out = static_cast<uInt>(kBufferSize);
+    res = deflate(&strm_, flush ? Z_FINISH : Z_NO_FLUSH);
+    assert(res != Z_STREAM_ERROR);  // state not clobbered
+    if (!Write(out_.get(), kBufferSize - strm_.avail_out)) return false;
+  } while (strm_.avail_out == 0);
+  return !flush || res == Z_STREAM_END;
+}
\ No newline at end of file
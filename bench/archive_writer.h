@@ -0,0 +1,51 @@
+#pragma once
+
+// What generated entries hold.
+enum class Content {
+  kText,    // words, deflates about as well as source code
+  kRandom,  // incompressible
+};
+
+// Writes a zip archive of generated entries, each deflated or stored. The
+// data of an entry depends on its seed only, so archives are reproducible.
+// Archives stay below 4 GiB and 65535 entries, without ZIP64.
+class ArchiveWriter {
+ public:
+  ArchiveWriter() = default;
+  ~ArchiveWriter();
+  ArchiveWriter(const ArchiveWriter& other) = delete;
+  ArchiveWriter(ArchiveWriter&& other) = delete;
+  ArchiveWriter& operator=(const ArchiveWriter& other) = delete;
+  ArchiveWriter& operator=(ArchiveWriter&& other) = delete;
+
+  bool Initialize(PCSTR path);
+  // Adds an entry of size bytes, parent directories are implied by name.
+  bool Add(PCSTR name, std::uint32_t size, bool deflate, Content content,
+           std::uint64_t seed);
+  // Writes the central directory and closes the archive.
+  bool Finish();
+
+ private:
+  struct Entry {
+    std::string name;
+    std::uint16_t method;
+    std::uint32_t crc32;
+    std::uint32_t compressed_size;
+    std::uint32_t uncompressed_size;
+    std::uint32_t offset;  // of the local file header
+  };
+
+  bool Write(const void* ptr, std::size_t size);
+  bool WriteAt(std::uint64_t offset, const void* ptr, std::size_t size);
+  // Deflates size bytes at ptr into the archive, flush ends the stream.
+  bool Deflate(const BYTE* ptr, std::size_t size, bool flush);
+
+  std::string path_;
+  HANDLE file_{INVALID_HANDLE_VALUE};
+  std::uint64_t offset_{0};  // where the next write goes
+  std::vector<Entry> entries_;
+  z_stream strm_{};
+  bool deflating_{false};  // strm_ initialized
+  std::unique_ptr<BYTE[]> in_;
+  std::unique_ptr<BYTE[]> out_;
+};
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include "stdafx.h"
+
+#include "http_server.h"
+
+namespace {
+
+constexpr std::size_t kPieceSize = 0x10000;       // 64 KiB
+constexpr std::size_t kMaxRequestSize = 0x10000;  // 64 KiB
+constexpr int kMaxSendSize = 0x100000;            // 1 MiB
+
+// Reads "bytes=FIRST-LAST", "bytes=FIRST-" or "bytes=-SUFFIX". False if the
+// range is to be ignored, multiple ranges included, otherwise satisfiable
+// tells whether it's within size.
+bool ParseRange(const std::string& value, std::uint64_t size,
+                std::uint64_t* first, std::uint64_t* last, bool* satisfiable) {
+  constexpr char kUnit[] = "bytes=";
+  if (value.compare(0, sizeof(kUnit) - 1, kUnit) != 0) return false;
+  auto spec = value.substr(sizeof(kUnit) - 1);
+  auto dash = spec.find('-');
+  if (dash == std::string::npos || spec.find(',') != std::string::npos)
+    return false;
+  auto digits = [](const std::string& s) {
+    return !s.empty() && s.find_first_not_of("0123456789") == std::string::npos;
+  };
+  auto begin = spec.substr(0, dash);
+  auto end = spec.substr(dash + 1);
+  auto number = [](const std::string& s) {
+    return static_cast<std::uint64_t>(std::stoull(s));
+  };
+  if (begin.empty()) {
+    if (!digits(end)) return false;
+    auto suffix = number(end);
+    *satisfiable = suffix && size;
+    *first = size - (std::min)(suffix, size);
+    *last = size - 1;
+    return true;
+  }
+  if (!digits(begin) || (!end.empty() && !digits(end))) return false;
+  *first = number(begin);
+  *last = end.empty() ? UINT64_MAX : number(end);
+  if (*last < *first) return false;
+  *last = (std::min)(*last, size - 1);
+  *satisfiable = *first < size;
+  return true;
+}
+
+}  // namespace
+
+HttpServer::~HttpServer() {
+  if (listener_ != INVALID_SOCKET) closesocket(listener_);  // ends Accept
+  if (thread_.joinable()) thread_.join();
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    for (auto connection : connections_) shutdown(connection, SD_BOTH);
+  }
+  for (auto& thread : connection_threads_) thread.join();
+}
+
+bool HttpServer::Initialize(PCSTR path, const HttpServerOptions& options) {
+  assert(listener_ == INVALID_SOCKET);
+  options_ = options;
+  auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    std::cerr << "error opening file " << path << " (code " << error << ')'
+              << std::endl;
+    return false;
+  }
+  file_.reset(file);
+  LARGE_INTEGER size{};
+  PVOID view = nullptr;
+  if (GetFileSizeEx(file, &size) && size.QuadPart) {
+    auto mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      mapping_.reset(mapping);
+      view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      view_.reset(view);
+    }
+  }
+  if (!view) {
+    auto error = GetLastError();
+    std::cerr << "error mapping file " << path << " (code " << error << ')'
+              << std::endl;
+    return false;
+  }
+  data_ = static_cast<const BYTE*>(view);
+  size_ = static_cast<std::uint64_t>(size.QuadPart);
+  listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;  // any free port
+  auto address_size = static_cast<int>(sizeof(address));
+  auto ok = listener_ != INVALID_SOCKET &&
+            bind(listener_, reinterpret_cast<sockaddr*>(&address),
+                 address_size) == 0 &&
+            listen(listener_, SOMAXCONN) == 0 &&
+            getsockname(listener_, reinterpret_cast<sockaddr*>(&address),
+                        &address_size) == 0;
+  if (!ok) {
+    std::cerr << "error listening on a loopback port (code "
+              << WSAGetLastError() << ')' << std::endl;
+    return false;
+  }
+  port_ = ntohs(address.sin_port);
+  thread_ = std::thread{&HttpServer::Accept, this};
+  return true;
+}
+
+void HttpServer::Accept() {
+  for (;;) {
+    auto connection = accept(listener_, NULL, NULL);
+    if (connection == INVALID_SOCKET) return;  // closed by the destructor
+    // headers go out without waiting for the body
+    BOOL no_delay = TRUE;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY,
+               reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+    std::lock_guard<std::mutex> lock{mutex_};
+    connections_.push_back(connection);
+    connection_threads_.emplace_back(&HttpServer::Serve, this, connection);
+  }
+}
+
+void HttpServer::Serve(SOCKET connection) {
+  std::string received;
+  char buffer[0x1000];
+  for (;;) {
+    auto end = received.find("\r\n\r\n");
+    if (end != std::string::npos) {
+      // the request line and headers, each ending with CRLF
+      auto request = received.substr(0, end + 2);
+      received.erase(0, end + 4);
+      if (!Respond(connection, request)) break;
+      continue;
+    }
+    if (kMaxRequestSize < received.size()) break;
+    auto size = recv(connection, buffer, sizeof(buffer), 0);
+    if (size <= 0) break;  // closed by the client
+    received.append(buffer, static_cast<std::size_t>(size));
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  connections_.erase(
+      std::find(connections_.begin(), connections_.end(), connection));
+  closesocket(connection);
+}
+
+bool HttpServer::Respond(SOCKET connection, const std::string& request) {
+  auto method = request.substr(0, request.find(' '));
+  auto head = method == "HEAD";
+  if (!head && method != "GET") {
+    constexpr char kNotAllowed[] =
+        "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n";
+    return Send(connection, kNotAllowed, sizeof(kNotAllowed) - 1);
+  }
+  // header names are case-insensitive
+  auto lower = request;
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](char ch) { return static_cast<char>(tolower(ch)); });
+  constexpr char kRangeHeader[] = "\r\nrange:";
+  auto pos = lower.find(kRangeHeader);
+  std::uint64_t first = 0;
+  std::uint64_t last = size_ - 1;
+  auto ranged = false;
+  auto satisfiable = true;
+  if (pos != std::string::npos) {
+    pos += sizeof(kRangeHeader) - 1;
+    auto value = lower.substr(pos, lower.find("\r\n", pos) - pos);
+    value.erase(std::remove(value.begin(), value.end(), ' '), value.end());
+    ranged = ParseRange(value, size_, &first, &last, &satisfiable);
+  }
+  auto total = std::to_string(size_);
+  std::string headers;
+  if (ranged && !satisfiable) {
+    headers = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" +
+              total + "\r\nContent-Length: 0\r\n\r\n";
+    return Send(connection, headers.data(), headers.size());
+  }
+  auto size = last - first + 1;
+  auto chunked = options_.chunked && !ranged;
+  headers = ranged ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+  headers += "Content-Type: application/zip\r\nAccept-Ranges: bytes\r\n";
+  if (ranged)
+    headers += "Content-Range: bytes " + std::to_string(first) + '-' +
+               std::to_string(last) + '/' + total + "\r\n";
+  headers += chunked ? "Transfer-Encoding: chunked\r\n"
+                     : "Content-Length: " + std::to_string(size) + "\r\n";
+  headers += "\r\n";
+  if (!Send(connection, headers.data(), headers.size())) return false;
+  if (head) return true;
+  for (auto ptr = data_ + first; size;) {
+    auto piece = static_cast<std::size_t>(
+        (std::min)(size, static_cast<std::uint64_t>(kPieceSize)));
+    Throttle(piece);
+    if (chunked) {
+      char line[32];
+      auto line_size = snprintf(line, sizeof(line), "%zx\r\n", piece);
+      if (!Send(connection, line, static_cast<std::size_t>(line_size)))
+        return false;
+    }
+    if (!Send(connection, ptr, piece)) return false;
+    if (chunked && !Send(connection, "\r\n", 2)) return false;
+    ptr += piece;
+    size -= piece;
+  }
+  return !chunked || Send(connection, "0\r\n\r\n", 5);
+}
+
+bool HttpServer::Send(SOCKET connection, const void* ptr, std::size_t size) {
+  auto bytes = static_cast<const char*>(ptr);
+  while (size) {
+    auto chunk = static_cast<int>(
+        (std::min)(size, static_cast<std::size_t>(kMaxSendSize)));
+    auto sent = send(connection, bytes, chunk, 0);
+    if (sent <= 0) return false;  // the client went away
+    bytes += sent;
+    size -= static_cast<std::size_t>(sent);
+  }
+  return true;
+}
+
+void HttpServer::Throttle(std::size_t size) {
+  if (!options_.bandwidth) return;
+  std::chrono::nanoseconds duration{static_cast<std::uint64_t>(size) *
+                                    1000000000 / options_.bandwidth};
+  std::chrono::steady_clock::time_point start;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    start = (std::max)(link_free_, std::chrono::steady_clock::now());
+    link_free_ = start + duration;
+  }
+  std::this_thread::sleep_until(start);
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+struct HttpServerOptions {
+  // full responses use chunked transfer encoding instead of Content-Length
+  bool chunked;
+  // bytes per second shared by all connections, 0 means no limit
+  std::uint64_t bandwidth;
+};
+
+// Serves one file over HTTP/1.1 on a loopback port, whatever the path, to
+// GET and HEAD requests with or without a single Range. Each connection is
+// served on a thread of its own and kept alive.
+class HttpServer {
+ public:
+  HttpServer() = default;
+  ~HttpServer();
+  HttpServer(const HttpServer& other) = delete;
+  HttpServer(HttpServer&& other) = delete;
+  HttpServer& operator=(const HttpServer& other) = delete;
+  HttpServer& operator=(HttpServer&& other) = delete;
+
+  bool Initialize(PCSTR path, const HttpServerOptions& options);
+  std::uint16_t port() const { return port_; }
+
+ private:
+  void Accept();
+  void Serve(SOCKET connection);
+  bool Respond(SOCKET connection, const std::string& request);
+  bool Send(SOCKET connection, const void* ptr, std::size_t size);
+  // Waits for the turn of size bytes on the throttled link.
+  void Throttle(std::size_t size);
+
+  HttpServerOptions options_{};
+  std::unique_ptr<void, decltype(&CloseHandle)> file_{nullptr, CloseHandle};
+  std::unique_ptr<void, decltype(&CloseHandle)> mapping_{nullptr,
+                                                         CloseHandle};
+  std::unique_ptr<void, decltype(&UnmapViewOfFile)> view_{nullptr,
+                                                          UnmapViewOfFile};
+  const BYTE* data_{nullptr};
+  std::uint64_t size_{0};
+  SOCKET listener_{INVALID_SOCKET};
+  std::uint16_t port_{0};
+  std::thread thread_;  // accepts connections
+  std::mutex mutex_;    // guards the members below
+  std::vector<std::thread> connection_threads_;
+  std::vector<SOCKET> connections_;
+  std::chrono::steady_clock::time_point link_free_;  // throttled link
+};
\ No newline at end of file
@@ -0,0 +1,411 @@
+#include "stdafx.h"
+
+#include "archive_writer.h"
+#include "http_server.h"
+
+namespace {
+
+// Archive of count generated entries, spread over directories of 100
+struct Scenario {
+  PCSTR name;
+  unsigned count;
+  std::uint32_t entry_size;
+  bool deflate;
+  Content content;
+};
+
+constexpr Scenario kScenarios[] = {
+    {"tiny-deflated", 20000, 0x400, true, Content::kText},
+    {"tiny-stored", 20000, 0x400, false, Content::kText},
+    {"huge-deflated", 4, 0x10000000, true, Content::kText},
+    {"huge-stored", 4, 0x10000000, false, Content::kRandom},
+    {"incompressible-deflated", 64, 0x1000000, true, Content::kRandom},
+};
+
+// How the archive is served and extracted
+struct Variant {
+  PCSTR name;
+  HttpServerOptions server;
+  PCSTR arguments;  // to downloadunzip
+  bool deflated;    // compares inflate backends, deflated scenarios only
+};
+
+constexpr std::uint64_t kThrottledBandwidth = 0x6400000;  // 100 MiB/s
+
+constexpr Variant kVariants[] = {
+    {"stream", {false, 0}, "", false},
+    {"chunked", {true, 0}, "", false},
+    {"network-thread", {false, 0}, "--network-thread", false},
+    {"threads", {false, 0}, "--threads 4", false},
+    {"ranges", {false, 0}, "--ranges 4", false},
+    {"throttled", {false, kThrottledBandwidth}, "", false},
+    {"inflate-buffer", {false, 0}, "--inflate buffer", true},
+};
+
+struct BenchOptions {
+  PSTR downloadunzip;
+  PSTR directory;  // archives and extracted files go here
+  unsigned scale;  // divides the data of every scenario
+  unsigned runs;   // of each variant, the fastest counts
+  PSTR only;       // scenario to run, nullptr runs all of them
+  PSTR baseline;   // results to compare against, nullptr if none
+  unsigned tolerance;  // percent of baseline throughput that may be lost
+};
+
+struct Result {
+  double seconds;
+  double cpu_seconds;  // user and kernel
+  std::uint64_t peak_rss;
+  DWORD exit_code;
+};
+
+void PrintHelp() {
+  // clang-format off
+  std::cerr << "Usage:\n";
+  std::cerr << "  bench [Options] DOWNLOADUNZIP DIRECTORY\n";
+  std::cerr << "\n";
+  std::cerr << "Runs DOWNLOADUNZIP against generated archives served from a loopback\n";
+  std::cerr << "HTTP server, one JSON line per scenario and variant on standard output.\n";
+  std::cerr << "Archives are generated in DIRECTORY once and reused, entries are\n";
+  std::cerr << "extracted to DIRECTORY\\out.\n";
+  std::cerr << "\n";
+  std::cerr << "Options:\n";
+  std::cerr << "  --scale N\n";
+  std::cerr << "  Divide the data of every scenario by N (1 by default).\n";
+  std::cerr << "  \n";
+  std::cerr << "  --runs N\n";
+  std::cerr << "  Run each variant N times and report the fastest run (1 by default).\n";
+  std::cerr << "  \n";
+  std::cerr << "  --only SCENARIO\n";
+  std::cerr << "  Run SCENARIO only.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --baseline FILE\n";
+  std::cerr << "  Compare throughput with the output of an earlier run in FILE and\n";
+  std::cerr << "  fail if any variant lost more than the tolerance.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --tolerance PERCENT\n";
+  std::cerr << "  Throughput a variant may lose against --baseline (10 by default).\n";
+  std::cerr << "  \n";
+  // clang-format on
+}
+
+bool ParseCommandLine(int argc, PSTR argv[], BenchOptions* options) {
+  options->scale = 1;
+  options->runs = 1;
+  options->tolerance = 10;
+  std::vector<PSTR> positional;
+  for (auto i = 1; i < argc; ++i) {
+    auto name = argv[i];
+    if (strncmp(name, "--", 2) != 0) {
+      positional.push_back(name);
+      continue;
+    }
+    name += 2;
+    if (++i == argc) return false;  // every option takes a value
+    PSTR end = nullptr;
+    if (strcmp(name, "scale") == 0) {
+      options->scale = strtoul(argv[i], &end, 10);
+      if (*end || !options->scale) return false;
+    } else if (strcmp(name, "runs") == 0) {
+      options->runs = strtoul(argv[i], &end, 10);
+      if (*end || !options->runs) return false;
+    } else if (strcmp(name, "tolerance") == 0) {
+      options->tolerance = strtoul(argv[i], &end, 10);
+      if (*end || 100 < options->tolerance) return false;
+    } else if (strcmp(name, "only") == 0)
+      options->only = argv[i];
+    else if (strcmp(name, "baseline") == 0)
+      options->baseline = argv[i];
+    else
+      return false;  // unknown option
+  }
+  if (positional.size() != 2) return false;
+  options->downloadunzip = positional[0];
+  options->directory = positional[1];
+  return true;
+}
+
+// Tiny entries come fewer, larger ones smaller.
+Scenario Scale(Scenario scenario, unsigned scale) {
+  if (scenario.entry_size <= 0x10000)
+    scenario.count = (std::max)(scenario.count / scale, 1u);
+  else
+    scenario.entry_size = (std::max)(scenario.entry_size / scale, 0x10000u);
+  return scenario;
+}
+
+std::string EntryName(unsigned i) {
+  return 'd' + std::to_string(i / 100) + "/f" + std::to_string(i % 100);
+}
+
+// Generates the archive of scenario unless path holds it already.
+bool Generate(const Scenario& scenario, const std::string& path) {
+  if (GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES)
+    return true;
+  std::cerr << "generating " << path << std::endl;
+  // an interrupted run leaves no partial archive behind
+  auto temp = path + ".tmp";
+  ArchiveWriter writer;
+  if (!writer.Initialize(temp.c_str())) return false;
+  for (auto i = 0u; i < scenario.count; ++i) {
+    auto name = EntryName(i);
+    if (!writer.Add(name.c_str(), scenario.entry_size, scenario.deflate,
+                    scenario.content, i))
+      return false;
+  }
+  if (!writer.Finish()) return false;
+  if (MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    return true;
+  auto error = GetLastError();
+  std::cerr << "error renaming " << temp << " (code " << error << ')'
+            << std::endl;
+  return false;
+}
+
+// Deletes path and everything below it, if it exists.
+bool RemoveTree(const std::string& path) {
+  WIN32_FIND_DATAA data;
+  auto find = FindFirstFileA((path + "\\*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+    return GetLastError() == ERROR_FILE_NOT_FOUND ||
+           GetLastError() == ERROR_PATH_NOT_FOUND;
+  auto ok = true;
+  do {
+    if (!strcmp(data.cFileName, ".") || !strcmp(data.cFileName, ".."))
+      continue;
+    auto child = path + '\\' + data.cFileName;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      ok = RemoveTree(child) && ok;
+    else
+      ok = DeleteFileA(child.c_str()) && ok;
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+  ok = RemoveDirectoryA(path.c_str()) && ok;
+  if (ok) return true;
+  std::cerr << "error removing " << path << " (code " << GetLastError()
+            << ')' << std::endl;
+  return false;
+}
+
+double Seconds(const FILETIME& time) {
+  ULARGE_INTEGER value{};
+  value.LowPart = time.dwLowDateTime;
+  value.HighPart = time.dwHighDateTime;
+  return static_cast<double>(value.QuadPart) / 10000000;  // 100 ns units
+}
+
+// Runs command line in directory, its standard output is discarded.
+bool Run(std::string command_line, const std::string& directory,
+         Result* result) {
+  SECURITY_ATTRIBUTES inheritable{sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+  std::unique_ptr<void, decltype(&CloseHandle)> null{
+      CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                  &inheritable, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL),
+      CloseHandle};
+  STARTUPINFOA startup_info{};
+  startup_info.cb = sizeof(startup_info);
+  startup_info.dwFlags = STARTF_USESTDHANDLES;
+  startup_info.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+  startup_info.hStdOutput = null.get();
+  startup_info.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+  PROCESS_INFORMATION process_info{};
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER start;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&start);
+  if (!CreateProcessA(NULL, &command_line[0], NULL, NULL, TRUE, 0, NULL,
+                      directory.c_str(), &startup_info, &process_info)) {
+    auto error = GetLastError();
+    std::cerr << "error running " << command_line << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  std::unique_ptr<void, decltype(&CloseHandle)> process{process_info.hProcess,
+                                                        CloseHandle};
+  CloseHandle(process_info.hThread);
+  WaitForSingleObject(process.get(), INFINITE);
+  LARGE_INTEGER end;
+  QueryPerformanceCounter(&end);
+  result->seconds = static_cast<double>(end.QuadPart - start.QuadPart) /
+                    static_cast<double>(frequency.QuadPart);
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  PROCESS_MEMORY_COUNTERS counters{};
+  auto ok =
+      GetExitCodeProcess(process.get(), &result->exit_code) &&
+      GetProcessTimes(process.get(), &creation_time, &exit_time, &kernel_time,
+                      &user_time) &&
+      GetProcessMemoryInfo(process.get(), &counters, sizeof(counters));
+  if (!ok) {
+    auto error = GetLastError();
+    std::cerr << "error querying " << command_line << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  result->cpu_seconds = Seconds(kernel_time) + Seconds(user_time);
+  result->peak_rss = counters.PeakWorkingSetSize;
+  return true;
+}
+
+// Extracts the archive at path with variant, the fastest of runs.
+bool Measure(const BenchOptions& options, const std::string& path,
+             const Variant& variant, Result* result) {
+  HttpServer server;
+  if (!server.Initialize(path.c_str(), variant.server)) return false;
+  auto url = "http://127.0.0.1:" + std::to_string(server.port()) + "/" +
+             path.substr(path.find_last_of("\\/") + 1);
+  auto command_line = '"' + std::string{options.downloadunzip} +
+                      "\" --overwrite " + variant.arguments + ' ' + url;
+  auto out = std::string{options.directory} + "\\out";
+  for (auto i = 0u; i < options.runs; ++i) {
+    // every run writes all files anew
+    if (!RemoveTree(out)) return false;
+    if (!CreateDirectoryA(out.c_str(), NULL)) {
+      auto error = GetLastError();
+      std::cerr << "error creating directory " << out << " (code " << error
+                << ')' << std::endl;
+      return false;
+    }
+    Result run{};
+    if (!Run(command_line, out, &run)) return false;
+    if (!i || run.seconds < result->seconds) *result = run;
+  }
+  return RemoveTree(out);
+}
+
+std::string FormatResult(const Scenario& scenario, const Variant& variant,
+                         std::uint64_t archive_size, const Result& result) {
+  auto bytes = static_cast<std::uint64_t>(scenario.count) * scenario.entry_size;
+  // MB/s of extracted data, 10^6 bytes to the MB
+  auto mb_per_s = static_cast<double>(bytes) / 1000000 / result.seconds;
+  auto entries_per_s = scenario.count / result.seconds;
+  return "{\"scenario\":\"" + std::string{scenario.name} +
+         "\",\"variant\":\"" + variant.name +
+         "\",\"entries\":" + std::to_string(scenario.count) +
+         ",\"bytes\":" + std::to_string(bytes) +
+         ",\"archive_bytes\":" + std::to_string(archive_size) +
+         ",\"seconds\":" + std::to_string(result.seconds) +
+         ",\"mb_per_s\":" + std::to_string(mb_per_s) +
+         ",\"entries_per_s\":" + std::to_string(entries_per_s) +
+         ",\"cpu_seconds\":" + std::to_string(result.cpu_seconds) +
+         ",\"peak_rss\":" + std::to_string(result.peak_rss) +
+         ",\"exit_code\":" + std::to_string(result.exit_code) + '}';
+}
+
+// The value of key in a JSON line written by FormatResult, empty if missing.
+std::string Field(const std::string& line, PCSTR key) {
+  auto name = '"' + std::string{key} + "\":";
+  auto pos = line.find(name);
+  if (pos == std::string::npos) return {};
+  pos += name.size();
+  if (line[pos] == '"') {
+    ++pos;
+    return line.substr(pos, line.find('"', pos) - pos);
+  }
+  return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+// Reads the throughput of each scenario and variant in a baseline.
+bool ReadBaseline(PCSTR path, std::vector<std::string>* lines) {
+  auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    std::cerr << "error opening baseline " << path << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  std::string text;
+  char buffer[0x1000];
+  DWORD read = 0;
+  while (ReadFile(file, buffer, sizeof(buffer), &read, NULL) && read)
+    text.append(buffer, read);
+  CloseHandle(file);
+  for (std::size_t pos = 0; pos < text.size();) {
+    auto end = (std::min)(text.find('\n', pos), text.size());
+    lines->push_back(text.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return true;
+}
+
+// The throughput of a line, false if it has none.
+bool ParseMBPerSecond(const std::string& line, double* mb_per_s) {
+  auto field = Field(line, "mb_per_s");
+  PSTR end = nullptr;
+  *mb_per_s = strtod(field.c_str(), &end);
+  return !field.empty() && *end == '\0';
+}
+
+// False if line lost more throughput than allowed against its baseline.
+bool CompareWithBaseline(const std::string& line,
+                         const std::vector<std::string>& baseline,
+                         unsigned tolerance) {
+  auto scenario = Field(line, "scenario");
+  auto variant = Field(line, "variant");
+  for (auto& base : baseline) {
+    if (Field(base, "scenario") != scenario ||
+        Field(base, "variant") != variant)
+      continue;
+    double mb_per_s = 0;
+    double base_mb_per_s = 0;
+    if (!ParseMBPerSecond(line, &mb_per_s) ||
+        !ParseMBPerSecond(base, &base_mb_per_s)) {
+      std::cerr << "baseline of " << scenario << ' ' << variant
+                << " has no valid mb_per_s" << std::endl;
+      return false;
+    }
+    if (base_mb_per_s * (100 - tolerance) / 100 <= mb_per_s) return true;
+    std::cerr << scenario << ' ' << variant << " regressed from "
+              << base_mb_per_s << " to " << mb_per_s << " MB/s" << std::endl;
+    return false;
+  }
+  return true;  // new variants pass
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  BenchOptions options{};
+  if (!ParseCommandLine(argc, argv, &options)) {
+    PrintHelp();
+    return 1;
+  }
+  WSADATA wsa_data;
+  auto error = WSAStartup(MAKEWORD(2, 2), &wsa_data);
+  if (error) {
+    std::cerr << "error initializing Winsock (code " << error << ')'
+              << std::endl;
+    return 1;
+  }
+  std::vector<std::string> baseline;
+  if (options.baseline && !ReadBaseline(options.baseline, &baseline))
+    return 1;
+  auto ok = true;
+  for (auto& scenario : kScenarios) {
+    if (options.only && strcmp(options.only, scenario.name) != 0) continue;
+    auto scaled = Scale(scenario, options.scale);
+    auto path = std::string{options.directory} + '\\' + scenario.name + '-' +
+                std::to_string(options.scale) + ".zip";
+    if (!Generate(scaled, path)) return 1;
+    WIN32_FILE_ATTRIBUTE_DATA attributes{};
+    GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes);
+    auto archive_size =
+        (static_cast<std::uint64_t>(attributes.nFileSizeHigh) << 32) |
+        attributes.nFileSizeLow;
+    for (auto& variant : kVariants) {
+      if (variant.deflated && !scenario.deflate) continue;
+      Result result{};
+      if (!Measure(options, path, variant, &result)) return 1;
+      auto line = FormatResult(scaled, variant, archive_size, result);
+      std::cout << line << std::endl;
+      if (result.exit_code) {
+        std::cerr << scenario.name << ' ' << variant.name << " failed"
+                  << std::endl;
+        ok = false;
+      }
+      if (!CompareWithBaseline(line, baseline, options.tolerance)) ok = false;
+    }
+  }
+  WSACleanup();
+  return ok ? 0 : 1;
+}
\ No newline at end of file
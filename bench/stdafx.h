@@ -0,0 +1,20 @@
+#pragma once
+#include <winsock2.h>
+#include <windows.h>
+#include <psapi.h>
+
+#include <zlib/zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
\ No newline at end of file
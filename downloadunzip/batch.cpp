@@ -0,0 +1,156 @@
+#include "stdafx.h"
+
+#include "batch.h"
+
+#include "cmdline.h"  // HexStringToByteArray
+
+namespace {
+
+constexpr std::size_t kSha256Length = 64;  // hex digits
+
+bool ParseManifestLine(const std::string& line, BatchItem* item) {
+  constexpr char kSpace[] = " \t\r";
+  std::vector<std::string> fields;
+  for (std::size_t pos = 0;;) {
+    pos = line.find_first_not_of(kSpace, pos);
+    if (pos == std::string::npos) break;
+    auto end = line.find_first_of(kSpace, pos);
+    if (end == std::string::npos) end = line.size();
+    fields.emplace_back(line, pos, end - pos);
+    pos = end;
+  }
+  if (fields.size() < 2 || 3 < fields.size()) return false;
+  item->url = fields[0];
+  item->directory = fields[1];
+  auto last = item->directory.back();
+  if (last != '/' && last != '\\') item->directory += '/';
+  item->sha256 = fields.size() == 3;
+  if (!item->sha256) return true;
+  return fields[2].size() == kSha256Length &&
+         HexStringToByteArray(fields[2].c_str(), item->sha256_bytes);
+}
+
+bool CreateDirectories(const std::string& path) {
+  // missing parents are created first, errors show up in the final check
+  for (auto pos = path.find_first_of("/\\", 1); pos != std::string::npos;
+       pos = path.find_first_of("/\\", pos + 1))
+    CreateDirectoryA(path.substr(0, pos).c_str(), NULL);
+  auto attributes = GetFileAttributesA(path.c_str());
+  if (attributes != INVALID_FILE_ATTRIBUTES &&
+      attributes & FILE_ATTRIBUTE_DIRECTORY)
+    return true;
+  auto error = GetLastError();
+  std::cerr << "error creating directory " << path << " (code " << error << ')'
+            << std::endl;
+  return false;
+}
+
+}  // namespace
+
+bool ReadManifest(PCSTR path, std::vector<BatchItem>* items) {
+  auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    std::cerr << "error opening manifest " << path << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  using file_t = std::unique_ptr<void, decltype(&CloseHandle)>;
+  auto guard = file_t{file, CloseHandle};
+  std::string text;
+  char buffer[0x1000];
+  for (DWORD read = 0; ReadFile(file, buffer, sizeof(buffer), &read, NULL) &&
+                       read;)
+    text.append(buffer, read);
+  // blank lines and lines starting with '#' are skipped
+  auto number = 0u;
+  for (std::size_t pos = 0; pos < text.size();) {
+    auto end = text.find('\n', pos);
+    if (end == std::string::npos) end = text.size();
+    auto line = text.substr(pos, end - pos);
+    pos = end + 1;
+    ++number;
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') continue;
+    BatchItem item{};
+    if (!ParseManifestLine(line, &item)) {
+      std::cerr << "invalid manifest line " << number << std::endl;
+      return false;
+    }
+    items->push_back(std::move(item));
+  }
+  return true;
+}
+
+bool Batch::Initialize(CURL* curl, CURLShare* share,
+                       CURLBytestreamOptions* options,
+                       UnzipOptions* unzip_options, bool dryrun) {
+  assert(curl);
+  assert(!curl_);
+  if (!loop_.Initialize(options->stats)) return false;
+  curl_ = curl;  // initialized
+  share_ = share;
+  options_ = *options;
+  options_.shared_loop = &loop_;
+  unzip_options_ = *unzip_options;
+  dryrun_ = dryrun;
+  return true;
+}
+
+bool Batch::Run(const std::vector<BatchItem>& items, unsigned jobs) {
+  items_ = &items;
+  std::vector<std::thread> threads;
+  for (auto i = 1u; i < jobs && i < items.size(); ++i)
+    threads.emplace_back(&Batch::Work, this);
+  Work();
+  for (auto& thread : threads) thread.join();
+  return !failed_;
+}
+
+void Batch::Work() {
+  for (std::size_t i = 0; (i = next_++) < items_->size();) {
+    auto& item = (*items_)[i];
+    if (Extract(item)) continue;
+    failed_ = true;
+    std::cerr << "error extracting " << item.url << std::endl;
+  }
+}
+
+bool Batch::Extract(const BatchItem& item) {
+  if (!dryrun_ && !CreateDirectories(item.directory))
+    return false;
+  std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl{
+      curl_easy_duphandle(curl_), curl_easy_cleanup};
+  if (!curl) {
+    std::cerr << "error initializing CURL" << std::endl;
+    return false;
+  }
+  share_->Attach(curl.get());
+  curl_easy_setopt(curl.get(), CURLOPT_HTTPGET, 1L);
+  curl_easy_setopt(curl.get(), CURLOPT_URL, item.url.c_str());
+  curl_easy_setopt(curl.get(), CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl.get(), CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  // wait for a connection that can be multiplexed rather than open another
+  curl_easy_setopt(curl.get(), CURLOPT_PIPEWAIT, 1L);
+  // hashed off the shared network thread
+  SHA256Worker sha256;
+  if (item.sha256 && !sha256.Initialize(nullptr, 0, options_.stats))
+    return false;
+  auto options = options_;
+  options.sha256 = item.sha256 ? &sha256 : nullptr;
+  CURLBytestreamAdapter adapter{nullptr};
+  if (!adapter.Initialize(curl.get(), &options)) return false;
+  auto unzip_options = unzip_options_;
+  unzip_options.directory = item.directory.c_str();
+  auto ok = Unzip(&adapter, &unzip_options);
+  if (!item.sha256) return ok;
+  adapter.RunToTheEnd();
+  BYTE sha256_bytes[32];
+  if (!sha256.Finish(sha256_bytes)) return false;
+  if (std::equal(std::cbegin(sha256_bytes), std::cend(sha256_bytes),
+                 std::cbegin(item.sha256_bytes)))
+    return ok;
+  std::cerr << "SHA-256 hash doesn't match for " << item.url << std::endl;
+  return false;
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include "curl_bytestream_adapter.h"
+#include "curl_share.h"
+#include "curl_shared_loop.h"
+#include "sha256_worker.h"
+#include "unzip.h"  // UnzipOptions
+
+// One "URL DIRECTORY [SHA256]" line of a --batch manifest.
+struct BatchItem {
+  std::string url;
+  std::string directory;  // ends with a slash
+  bool sha256;
+  BYTE sha256_bytes[32];
+};
+
+bool ReadManifest(PCSTR path, std::vector<BatchItem>* items);
+
+// Downloads and extracts many archives, several at a time. Transfers run on
+// one shared loop, so archives on the same host reuse its connections and,
+// with HTTP/2, are multiplexed over one of them.
+class Batch {
+ public:
+  Batch() = default;
+  Batch(const Batch& other) = delete;
+  Batch(Batch&& other) = delete;
+  Batch& operator=(const Batch& other) = delete;
+  Batch& operator=(Batch&& other) = delete;
+
+  // Transfers are duplicates of curl attached to share, which holds the
+  // cookies of the login request. The item directories are created unless
+  // dryrun is set.
+  bool Initialize(CURL* curl, CURLShare* share, CURLBytestreamOptions* options,
+                  UnzipOptions* unzip_options, bool dryrun);
+  // Extracts up to jobs archives at once, each on a thread of its own.
+  bool Run(const std::vector<BatchItem>& items, unsigned jobs);
+
+ private:
+  void Work();
+  bool Extract(const BatchItem& item);
+
+  CURL* curl_{nullptr};
+  CURLShare* share_{nullptr};
+  CURLBytestreamOptions options_{};
+  UnzipOptions unzip_options_{};
+  bool dryrun_{false};
+  CURLSharedLoop loop_;
+  const std::vector<BatchItem>* items_{nullptr};
+  std::atomic<std::size_t> next_{0};  // item to extract
+  std::atomic<bool> failed_{false};
+};
\ No newline at end of file
@@ -9,11 +9,12 @@ bool Read(IBytestream* stream, PVOID ptr, std::size_t size) {
   return size == 0;
 }
 
-bool Skip(IBytestream* stream, std::size_t size) {
-  constexpr std::size_t kBufferSize = 0x400;  // 1 KiB
-  static BYTE Buffer[kBufferSize];
-  for (; kBufferSize <= size && Read(stream, Buffer, kBufferSize);
-       size -= kBufferSize)
-    ;
-  return Read(stream, Buffer, size);
+bool Skip(IBytestream* stream, std::uint64_t size) {
+  PBYTE ptr = nullptr;
+  for (std::size_t avail = 0; size && stream->Peek(&ptr, &avail) && avail;) {
+    if (size < avail) avail = static_cast<std::size_t>(size);
+    stream->Consume(avail);
+    size -= avail;
+  }
+  return size == 0;
 }
\ No newline at end of file
@@ -1,8 +1,13 @@
 #pragma once
 
 struct IBytestream {
+  virtual ~IBytestream() = default;
   virtual bool Read(PVOID ptr, std::size_t size, std::size_t* read) = 0;
+  // Points *ptr at the next contiguous bytes without consuming them, *size is
+  // zero at the end of the stream. The span stays valid until Consume().
+  virtual bool Peek(PBYTE* ptr, std::size_t* size) = 0;
+  virtual void Consume(std::size_t size) = 0;
 };
 
 bool Read(IBytestream* stream, PVOID ptr, std::size_t size);
-bool Skip(IBytestream* stream, std::size_t size);
\ No newline at end of file
+bool Skip(IBytestream* stream, std::uint64_t size);
\ No newline at end of file
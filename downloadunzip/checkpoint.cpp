@@ -0,0 +1,71 @@
+#include "stdafx.h"
+
+#include "checkpoint.h"
+
+bool Checkpoint::Initialize(PCSTR path, PCSTR url, CheckpointState* state,
+                            bool* resumed) {
+  assert(!file_);
+  auto file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                          OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    std::cerr << "error opening checkpoint file " << path << " (code "
+              << GetLastError() << ')' << std::endl;
+    return false;
+  }
+  file_.reset(file);
+  path_ = path;
+  url_crc_ = crc32(0, reinterpret_cast<const Bytef*>(url),
+                   static_cast<uInt>(strlen(url)));
+  // pick the newest intact slot
+  *resumed = false;
+  Record records[2]{};
+  DWORD read = 0;
+  if (!ReadFile(file, records, sizeof(records), &read, NULL)) {
+    std::cerr << "error reading checkpoint file " << path << " (code "
+              << GetLastError() << ')' << std::endl;
+    return false;
+  }
+  auto empty = true;
+  for (auto i = 0u; i < read / sizeof(Record); ++i) {
+    auto& record = records[i];
+    if (record.signature != Record::kSignature) continue;
+    if (record.crc != Checksum(record)) continue;
+    empty = false;
+    if (record.url_crc != url_crc_) continue;
+    if (*resumed && record.sequence < sequence_) continue;
+    *state = record.state;
+    sequence_ = record.sequence;
+    *resumed = true;
+  }
+  if (*resumed || empty) return true;
+  std::cerr << "checkpoint file " << path << " belongs to another URL"
+            << std::endl;
+  return false;
+}
+
+bool Checkpoint::Save(const CheckpointState& state) {
+  if (failed_) return false;
+  Record record{Record::kSignature, url_crc_, ++sequence_, state, 0};
+  record.crc = Checksum(record);
+  LARGE_INTEGER offset{};
+  offset.QuadPart = (sequence_ % 2) * sizeof(Record);
+  DWORD written = 0;
+  auto ok = SetFilePointerEx(file_.get(), offset, NULL, FILE_BEGIN) &&
+            WriteFile(file_.get(), &record, sizeof(Record), &written, NULL);
+  if (ok) return true;
+  failed_ = true;
+  std::cerr << "error writing checkpoint file " << path_ << " (code "
+            << GetLastError() << ')' << std::endl;
+  return false;
+}
+
+void Checkpoint::Remove() {
+  if (!file_) return;
+  file_.reset();
+  DeleteFileA(path_);
+}
+
+std::uint32_t Checkpoint::Checksum(const Record& record) {
+  return crc32(0, reinterpret_cast<const Bytef*>(&record),
+               static_cast<uInt>(offsetof(Record, crc)));
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+#include "sha256.h"
+
+// Progress of a run, enough to resume an interrupted download from the first
+// unfinished entry.
+struct CheckpointState {
+  std::uint64_t offset;   // of the first unfinished local file header
+  std::uint64_t entries;  // extracted before offset
+  SHA256State sha256;     // nothing hashed without --sha256
+};
+
+// Keeps the latest state in a file. Two slots are written in turns, so a run
+// interrupted in the middle of a write still leaves the previous state.
+class Checkpoint {
+ public:
+  Checkpoint() = default;
+  Checkpoint(const Checkpoint& other) = delete;
+  Checkpoint(Checkpoint&& other) = delete;
+  Checkpoint& operator=(const Checkpoint& other) = delete;
+  Checkpoint& operator=(Checkpoint&& other) = delete;
+
+  // Opens or creates the file, *resumed tells whether it holds a state for
+  // the URL given.
+  bool Initialize(PCSTR path, PCSTR url, CheckpointState* state,
+                  bool* resumed);
+  bool Save(const CheckpointState& state);
+  // Deletes the file once the run succeeded.
+  void Remove();
+
+ private:
+  struct Record {
+    static constexpr std::uint32_t kSignature = 0x50435544;  // "DUCP"
+    std::uint32_t signature;
+    std::uint32_t url_crc;
+    std::uint64_t sequence;
+    CheckpointState state;
+    std::uint32_t crc;  // of the fields above
+  };
+
+  static std::uint32_t Checksum(const Record& record);
+
+  std::unique_ptr<void, decltype(&CloseHandle)> file_{nullptr, CloseHandle};
+  PCSTR path_{nullptr};
+  std::uint32_t url_crc_{0};
+  std::uint64_t sequence_{0};
+  bool failed_{false};  // reported once, the run goes on without checkpoints
+};
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "stdafx.h"
+
+#include "chunk_pool.h"
+
+ChunkRef::ChunkRef(const ChunkRef& other) : chunk_{other.chunk_} {
+  if (chunk_) ++chunk_->refs;
+}
+
+ChunkRef& ChunkRef::operator=(const ChunkRef& other) {
+  if (other.chunk_) ++other.chunk_->refs;
+  Reset();
+  chunk_ = other.chunk_;
+  return *this;
+}
+
+ChunkRef& ChunkRef::operator=(ChunkRef&& other) {
+  if (this == &other) return *this;
+  Reset();
+  chunk_ = other.chunk_;
+  other.chunk_ = nullptr;
+  return *this;
+}
+
+void ChunkRef::Reset() {
+  if (chunk_ && --chunk_->refs == 0) chunk_->pool->Free(chunk_);
+  chunk_ = nullptr;
+}
+
+ChunkPool::~ChunkPool() {
+  for (auto chunk : free_) delete chunk;
+}
+
+ChunkRef ChunkPool::Allocate() {
+  Chunk* chunk = nullptr;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (!free_.empty()) {
+      chunk = free_.back();
+      free_.pop_back();
+    }
+  }
+  if (!chunk) {
+    chunk = new Chunk;
+    chunk->pool = this;
+  }
+  chunk->refs = 1;
+  chunk->size = 0;
+  return ChunkRef{chunk};
+}
+
+void ChunkPool::Free(Chunk* chunk) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  free_.push_back(chunk);
+}
\ No newline at end of file
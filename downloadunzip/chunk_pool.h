@@ -0,0 +1,53 @@
+#pragma once
+
+class ChunkPool;
+
+// Fixed size buffer shared by reference between the stages of a transfer.
+struct Chunk {
+  static constexpr std::size_t kCapacity = 0x10000;  // 64 KiB
+
+  ChunkPool* pool;
+  std::atomic<unsigned> refs;
+  std::size_t size;
+  BYTE data[kCapacity];
+};
+
+class ChunkRef {
+ public:
+  ChunkRef() = default;
+  explicit ChunkRef(Chunk* chunk) : chunk_{chunk} {}
+  ~ChunkRef() { Reset(); }
+  ChunkRef(const ChunkRef& other);
+  ChunkRef(ChunkRef&& other) : chunk_{other.chunk_} { other.chunk_ = nullptr; }
+  ChunkRef& operator=(const ChunkRef& other);
+  ChunkRef& operator=(ChunkRef&& other);
+
+  void Reset();
+  Chunk* get() const { return chunk_; }
+  Chunk* operator->() const { return chunk_; }
+  explicit operator bool() const { return chunk_ != nullptr; }
+
+ private:
+  Chunk* chunk_{nullptr};
+};
+
+// Recycles chunks so that steady state transfers do no heap allocations.
+// Must outlive every ChunkRef it handed out.
+class ChunkPool {
+ public:
+  ChunkPool() = default;
+  ~ChunkPool();
+  ChunkPool(const ChunkPool& other) = delete;
+  ChunkPool(ChunkPool&& other) = delete;
+  ChunkPool& operator=(const ChunkPool& other) = delete;
+  ChunkPool& operator=(ChunkPool&& other) = delete;
+
+  ChunkRef Allocate();
+
+ private:
+  friend class ChunkRef;
+  void Free(Chunk* chunk);
+
+  std::mutex mutex_;
+  std::vector<Chunk*> free_;
+};
\ No newline at end of file
@@ -4,6 +4,13 @@
 
 namespace {
 
+constexpr std::size_t kDefaultRingSize = 0x800000;    // 8 MiB
+constexpr std::size_t kDefaultMaxBuffer = 0x4000000;  // 64 MiB
+constexpr unsigned kDefaultJobs = 4;
+constexpr std::size_t kDefaultInflateThreshold = 0x100000;  // 1 MiB
+constexpr std::size_t kMaxInflateThreshold = 0x10000000;    // 256 MiB
+constexpr std::size_t kDefaultMaxHeld = 0x40000000;         // 1 GiB
+
 bool InitLoginUrl(ProgramOptions* options) {
   static char Buffer[MAX_PATH];
   if (!options->login_path) return true;
@@ -43,6 +50,37 @@ inline bool CharToInt(char ch, int* val) {
   return true;
 }
 
+// Parses a byte count with an optional K, M or G suffix.
+bool ParseSize(PCSTR str, std::size_t* size) {
+  PSTR end = nullptr;
+  errno = 0;
+  auto value = strtoull(str, &end, 10);
+  if (end == str || errno == ERANGE) return false;
+  auto shift = 0;
+  switch (*end) {
+    case 'K':
+      shift = 10;
+      break;
+    case 'M':
+      shift = 20;
+      break;
+    case 'G':
+      shift = 30;
+      break;
+    case 0:
+      break;
+    default:
+      return false;
+  }
+  if (shift && *++end) return false;
+  // the suffix may not carry the value past what size_t holds
+  if (SIZE_MAX >> shift < value) return false;
+  *size = static_cast<std::size_t>(value << shift);
+  return true;
+}
+
+}  // namespace
+
 bool HexStringToByteArray(PCSTR hex, BYTE (&bytes)[32]) {
   for (auto i = 0, j = 0; hex[i] && j < sizeof(bytes); i += 2, ++j) {
     auto i1 = 0, i2 = 0;
@@ -52,10 +90,11 @@ bool HexStringToByteArray(PCSTR hex, BYTE (&bytes)[32]) {
   return true;
 }
 
-}  // namespace
-
 bool ParseCommandLine(int argc, PSTR argv[], ProgramOptions* options) {
   if (argc < 2) return false;
+  options->max_buffer = kDefaultMaxBuffer;
+  options->inflate_threshold = kDefaultInflateThreshold;
+  options->max_held = kDefaultMaxHeld;
   for (int i = 1; i < argc; ++i) {
     if (strncmp(argv[i], "--", 2) == 0) {
       // option
@@ -70,12 +109,88 @@ bool ParseCommandLine(int argc, PSTR argv[], ProgramOptions* options) {
         if (++i == argc) return false;
         if (!HexStringToByteArray(argv[i], options->sha256_bytes)) return false;
         options->sha256 = true;
-      } else if (strcmp(name, "overwrite") == 0)
+      } else if (strcmp(name, "entry-sha256") == 0) {
+        if (++i == argc) return false;
+        options->entry_sha256 = argv[i];
+      } else if (strcmp(name, "include") == 0) {
+        if (++i == argc) return false;
+        options->filter.Include(argv[i]);
+      } else if (strcmp(name, "exclude") == 0) {
+        if (++i == argc) return false;
+        options->filter.Exclude(argv[i]);
+      } else if (strcmp(name, "threads") == 0) {
+        if (++i == argc) return false;
+        PSTR end = nullptr;
+        options->threads = strtoul(argv[i], &end, 10);
+        if (*end) return false;
+      } else if (strcmp(name, "write-buffers") == 0) {
+        if (++i == argc) return false;
+        PSTR end = nullptr;
+        options->write_buffers = strtoul(argv[i], &end, 10);
+        if (*end) return false;
+      } else if (strcmp(name, "file-threads") == 0) {
+        if (++i == argc) return false;
+        PSTR end = nullptr;
+        options->file_threads = strtoul(argv[i], &end, 10);
+        if (*end) return false;
+      } else if (strcmp(name, "map-size") == 0) {
+        if (++i == argc) return false;
+        if (!ParseSize(argv[i], &options->map_size)) return false;
+      } else if (strcmp(name, "checkpoint") == 0) {
+        if (++i == argc) return false;
+        options->checkpoint = argv[i];
+      } else if (strcmp(name, "trace") == 0) {
+        if (++i == argc) return false;
+        options->trace = argv[i];
+      } else if (strcmp(name, "batch") == 0) {
+        if (++i == argc) return false;
+        options->batch = argv[i];
+      } else if (strcmp(name, "input") == 0) {
+        if (++i == argc) return false;
+        options->input = argv[i];
+      } else if (strcmp(name, "jobs") == 0) {
+        if (++i == argc) return false;
+        PSTR end = nullptr;
+        options->jobs = strtoul(argv[i], &end, 10);
+        if (*end || !options->jobs) return false;
+      } else if (strcmp(name, "ranges") == 0) {
+        if (++i == argc) return false;
+        PSTR end = nullptr;
+        options->ranges = strtoul(argv[i], &end, 10);
+        if (*end) return false;
+      } else if (strcmp(name, "ring-size") == 0) {
+        if (++i == argc) return false;
+        if (!ParseSize(argv[i], &options->ring_size)) return false;
+      } else if (strcmp(name, "max-buffer") == 0) {
+        if (++i == argc) return false;
+        if (!ParseSize(argv[i], &options->max_buffer)) return false;
+      } else if (strcmp(name, "max-held") == 0) {
+        if (++i == argc) return false;
+        if (!ParseSize(argv[i], &options->max_held)) return false;
+      } else if (strcmp(name, "inflate") == 0) {
+        if (++i == argc) return false;
+        if (!ParseInflateBackend(argv[i], &options->inflate)) return false;
+      } else if (strcmp(name, "inflate-threshold") == 0) {
+        if (++i == argc) return false;
+        if (!ParseSize(argv[i], &options->inflate_threshold) ||
+            kMaxInflateThreshold < options->inflate_threshold)
+          return false;
+      } else if (strcmp(name, "network-thread") == 0)
+        options->network_thread = true;
+      else if (strcmp(name, "preallocate") == 0)
+        options->preallocate = true;
+      else if (strcmp(name, "overwrite") == 0)
         options->overwrite = true;
+      else if (strcmp(name, "update") == 0)
+        options->update = true;
       else if (strcmp(name, "save") == 0)
         options->save = true;
+      else if (strcmp(name, "tar") == 0)
+        options->tar = true;
       else if (strcmp(name, "dryrun") == 0)
         options->dryrun = true;
+      else if (strcmp(name, "stats") == 0)
+        options->stats = true;
       else if (strcmp(name, "verbose") == 0)
         options->verbose = true;
       else
@@ -83,6 +198,55 @@ bool ParseCommandLine(int argc, PSTR argv[], ProgramOptions* options) {
     } else
       options->url = argv[i];
   }
+  // batch transfers share one network thread
+  if ((options->network_thread || options->batch) && !options->ring_size)
+    options->ring_size = kDefaultRingSize;
+  if (!options->jobs) options->jobs = kDefaultJobs;
+  if (options->ranges && (options->save || options->sha256)) {
+    std::cerr << "--ranges can't be combined with --save or --sha256"
+              << std::endl;
+    return false;
+  }
+  if (options->checkpoint && options->save) {
+    std::cerr << "--checkpoint can't be combined with --save" << std::endl;
+    return false;
+  }
+  if (options->tar && (options->batch || options->update ||
+                       options->checkpoint || options->dryrun)) {
+    std::cerr << "--tar can't be combined with --batch, --update, "
+                 "--checkpoint or --dryrun"
+              << std::endl;
+    return false;
+  }
+  if (options->input) {
+    if (options->batch || options->save || options->login_path ||
+        options->checkpoint) {
+      std::cerr << "--input can't be combined with --batch, --save, --login "
+                   "or --checkpoint"
+                << std::endl;
+      return false;
+    }
+    if (options->url) {
+      std::cerr << "--input can't be combined with a URL" << std::endl;
+      return false;
+    }
+    if (options->ranges && strcmp(options->input, "-") == 0) {
+      std::cerr << "--ranges can't be combined with --input -" << std::endl;
+      return false;
+    }
+    return true;
+  }
+  if (options->batch) {
+    if (options->save || options->sha256 || options->ranges ||
+        options->checkpoint) {
+      std::cerr << "--batch can't be combined with --save, --sha256, --ranges "
+                   "or --checkpoint"
+                << std::endl;
+      return false;
+    }
+    // URL is needed to resolve --login only
+    if (!options->login_path) return true;
+  }
   return options->url && options->url[0] && InitLoginUrl(options);
 }
 
@@ -92,6 +256,8 @@ void PrintHelp() {
   std::cerr << "\n";
   std::cerr << "Usage:\n";
   std::cerr << "  download-unzip [Options] URL\n";
+  std::cerr << "  download-unzip [Options] --batch FILE [URL]\n";
+  std::cerr << "  download-unzip [Options] --input FILE\n";
   std::cerr << "\n";
   std::cerr << "Options:\n";
   std::cerr << "  --login PATH\n";
@@ -105,15 +271,125 @@ void PrintHelp() {
   std::cerr << "  --overwrite\n";
   std::cerr << "  Overwrite local files.\n";
   std::cerr << "  \n";
+  std::cerr << "  --update\n";
+  std::cerr << "  Overwrite only local files that differ from the archive entries in\n";
+  std::cerr << "  size, modification time or CRC-32. Unchanged entries are skipped,\n";
+  std::cerr << "  with --ranges they aren't downloaded at all. CRCs of local files are\n";
+  std::cerr << "  kept in .downloadunzip-index in the current directory. Extracted\n";
+  std::cerr << "  files get the modification time of their entries.\n";
+  std::cerr << "  \n";
   std::cerr << "  --sha256 HEXSTRING\n";
   std::cerr << "  SHA-256 digest to verify file integrity.\n";
   std::cerr << "  \n";
+  std::cerr << "  --entry-sha256 FILE\n";
+  std::cerr << "  Write SHA-256 digests of extracted files to FILE, in the format\n";
+  std::cerr << "  sha256sum -c reads.\n";
+  std::cerr << "  \n";
   std::cerr << "  --save\n";
   std::cerr << "  Save ZIP file to disk.\n";
   std::cerr << "  \n";
+  std::cerr << "  --include PATTERN\n";
+  std::cerr << "  Extract only entries matching PATTERN, may be repeated.\n";
+  std::cerr << "  '*' and '?' don't match '/', '**' matches across directories, \"a/**/b\"\n";
+  std::cerr << "  matches \"a/b\" too.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --exclude PATTERN\n";
+  std::cerr << "  Skip entries matching PATTERN, may be repeated.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --threads COUNT\n";
+  std::cerr << "  Extract entries on COUNT worker threads while downloading.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --write-buffers COUNT\n";
+  std::cerr << "  Create, write and close files on a separate thread per extracting\n";
+  std::cerr << "  thread, with up to COUNT 1M buffers waiting to be written. The\n";
+  std::cerr << "  thread writes one buffer at a time through the file cache: Windows\n";
+  std::cerr << "  completes writes that extend a file synchronously even when they\n";
+  std::cerr << "  are overlapped, so more writes in flight wouldn't overlap for\n";
+  std::cerr << "  extracted files.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --file-threads COUNT\n";
+  std::cerr << "  Create, write and close files up to 1M on a pool of COUNT threads,\n";
+  std::cerr << "  for archives of many small files.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --preallocate\n";
+  std::cerr << "  Reserve disk space for each file before writing it, so large files\n";
+  std::cerr << "  aren't fragmented.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --map-size SIZE\n";
+  std::cerr << "  Write files of SIZE and larger through a memory mapping, inflating\n";
+  std::cerr << "  straight into the file. K/M/G suffixes allowed, 0 (default) never\n";
+  std::cerr << "  maps. Files past 1G are written instead in 32-bit builds.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --inflate BACKEND\n";
+  std::cerr << "  How to inflate entries, \"stream\" (default) inflates through a small\n";
+  std::cerr << "  window, \"buffer\" inflates entries up to --inflate-threshold with\n";
+  std::cerr << "  one call.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --inflate-threshold SIZE\n";
+  std::cerr << "  Largest entry, compressed or not, inflated with one call (1M by\n";
+  std::cerr << "  default, 256M at most). K/M/G suffixes allowed. Each thread holds\n";
+  std::cerr << "  two buffers as large as the largest entry inflated so.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --max-buffer SIZE\n";
+  std::cerr << "  Pause the download when SIZE bytes wait to be extracted.\n";
+  std::cerr << "  K/M/G suffixes allowed, 0 means no limit (64M by default).\n";
+  std::cerr << "  \n";
+  std::cerr << "  --network-thread\n";
+  std::cerr << "  Download on a separate thread while extracting.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --ring-size SIZE\n";
+  std::cerr << "  Network thread buffer size, replaces --max-buffer (8M by default).\n";
+  std::cerr << "  \n";
+  std::cerr << "  --ranges COUNT\n";
+  std::cerr << "  Download entries with COUNT concurrent range requests driven by\n";
+  std::cerr << "  the central directory. Falls back to a single download if the\n";
+  std::cerr << "  server doesn't support ranges.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --checkpoint FILE\n";
+  std::cerr << "  Record progress in FILE after each extracted entry. If FILE holds\n";
+  std::cerr << "  progress of an interrupted run, resume the download from the first\n";
+  std::cerr << "  unfinished entry, overwriting local files. FILE is deleted on success.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --batch FILE\n";
+  std::cerr << "  Download and unzip the archives listed in FILE, one\n";
+  std::cerr << "  \"URL DIRECTORY [SHA256]\" line per archive, instead of URL.\n";
+  std::cerr << "  Archives share connections, multiplexed over HTTP/2 if the\n";
+  std::cerr << "  server supports it, and the cookies of --login, which is\n";
+  std::cerr << "  resolved against URL.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --jobs COUNT\n";
+  std::cerr << "  Unzip up to COUNT archives of --batch at once (4 by default).\n";
+  std::cerr << "  \n";
+  std::cerr << "  --input FILE\n";
+  std::cerr << "  Unzip FILE on disk instead of downloading URL, \"-\" reads the\n";
+  std::cerr << "  archive from standard input. FILE is memory mapped, with --ranges\n";
+  std::cerr << "  its entries are located through the central directory, whatever\n";
+  std::cerr << "  the COUNT.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --tar\n";
+  std::cerr << "  Write the entries to standard output as a tar stream instead of\n";
+  std::cerr << "  extracting them. Entries with a data descriptor are held in\n";
+  std::cerr << "  memory until they end, unless --ranges takes their size from\n";
+  std::cerr << "  the central directory.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --max-held SIZE\n";
+  std::cerr << "  Fail --tar on an entry held in memory past SIZE bytes. K/M/G\n";
+  std::cerr << "  suffixes allowed, 0 means no limit (1G by default).\n";
+  std::cerr << "  \n";
   std::cerr << "  --dryrun\n";
   std::cerr << "  Operate as usual but write nothing to disk.\n";
   std::cerr << "  \n";
+  std::cerr << "  --stats\n";
+  std::cerr << "  Print a JSON line to standard error at exit, with the time, bytes and\n";
+  std::cerr << "  calls of each stage (network, waits for the network, inflate, unzstd,\n";
+  std::cerr << "  crc32, sha256, write and disk, the writes of --write-buffers and\n";
+  std::cerr << "  --file-threads threads) and the peak of buffered download data.\n";
+  std::cerr << "  \n";
+  std::cerr << "  --trace FILE\n";
+  std::cerr << "  Save a timeline of each entry (header, open, inflate or copy, verify,\n";
+  std::cerr << "  close), of waits for the network and of the login to FILE as Chrome\n";
+  std::cerr << "  trace-event JSON, which Perfetto and chrome://tracing load.\n";
+  std::cerr << "  \n";
   std::cerr << "  --verbose\n";
   std::cerr << "  Set verbose mode on.\n";
   std::cerr << "  \n";
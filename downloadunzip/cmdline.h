@@ -1,18 +1,42 @@
 #pragma once
+#include "entry_filter.h"
 #include "unzip.h"  // UnzipOptions
 
 struct ProgramOptions {
   PSTR url;
+  PSTR input;
   PSTR login_url;
   PSTR login_path;
   PSTR login_post_data;
   bool sha256;
   BYTE sha256_bytes[32];
+  PSTR entry_sha256;
   bool save;
   bool overwrite;
+  bool update;
+  bool tar;
+  std::size_t max_held;
   bool dryrun;
+  bool stats;
+  PSTR trace;
   bool verbose;
+  unsigned threads;
+  unsigned write_buffers;
+  unsigned file_threads;
+  bool preallocate;
+  std::size_t map_size;
+  bool network_thread;
+  std::size_t ring_size;
+  std::size_t max_buffer;
+  unsigned ranges;
+  PSTR checkpoint;
+  PSTR batch;
+  unsigned jobs;
+  InflateBackend inflate;
+  std::size_t inflate_threshold;
+  EntryFilter filter;
 };
 
 bool ParseCommandLine(int argc, PSTR argv[], ProgramOptions *options);
 void PrintHelp();
+bool HexStringToByteArray(PCSTR hex, BYTE (&bytes)[32]);
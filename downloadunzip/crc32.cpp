@@ -0,0 +1,118 @@
+#include "stdafx.h"
+// https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/fast-crc-computation-generic-polynomials-pclmulqdq-paper.pdf
+#include "crc32.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#define CRC32_PCLMUL
+#endif
+
+namespace {
+
+using Crc32Proc = std::uint32_t (*)(std::uint32_t crc, const BYTE* ptr,
+                                    std::size_t size);
+
+std::uint32_t Crc32Zlib(std::uint32_t crc, const BYTE* ptr, std::size_t size) {
+  // crc32_z takes sizes beyond 4 GiB
+  return static_cast<std::uint32_t>(crc32_z(crc, ptr, size));
+}
+
+#ifdef CRC32_PCLMUL
+
+constexpr std::size_t kBlockSize = 64;  // folded four lanes at a time
+
+// bit-reflected constants from the paper, x^(4*128+64) mod P(x) and so on
+alignas(16) constexpr std::uint64_t kK1K2[] = {0x0154442bd4, 0x01c6e41596};
+alignas(16) constexpr std::uint64_t kK3K4[] = {0x01751997d0, 0x00ccaa009e};
+alignas(16) constexpr std::uint64_t kK5K0[] = {0x0163cd6124, 0x0000000000};
+alignas(16) constexpr std::uint64_t kPoly[] = {0x01db710641, 0x01f7011641};
+
+inline __m128i Fold(__m128i x, __m128i k, __m128i data) {
+  auto lo = _mm_clmulepi64_si128(x, k, 0x00);
+  auto hi = _mm_clmulepi64_si128(x, k, 0x11);
+  return _mm_xor_si128(_mm_xor_si128(hi, lo), data);
+}
+
+inline __m128i Load(const BYTE* ptr) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+}
+
+inline __m128i Load(const std::uint64_t (&constants)[2]) {
+  return _mm_load_si128(reinterpret_cast<const __m128i*>(constants));
+}
+
+// size is a multiple of 16, at least kBlockSize, crc is not inverted
+std::uint32_t FoldBlocks(std::uint32_t crc, const BYTE* ptr,
+                         std::size_t size) {
+  auto x1 = _mm_xor_si128(Load(ptr), _mm_cvtsi32_si128(crc));
+  auto x2 = Load(ptr + 0x10);
+  auto x3 = Load(ptr + 0x20);
+  auto x4 = Load(ptr + 0x30);
+  ptr += kBlockSize;
+  size -= kBlockSize;
+  // four lanes hide the multiplication latency
+  auto k = Load(kK1K2);
+  for (; kBlockSize <= size; ptr += kBlockSize, size -= kBlockSize) {
+    x1 = Fold(x1, k, Load(ptr));
+    x2 = Fold(x2, k, Load(ptr + 0x10));
+    x3 = Fold(x3, k, Load(ptr + 0x20));
+    x4 = Fold(x4, k, Load(ptr + 0x30));
+  }
+  // lanes into one, then the remaining 16 byte blocks
+  k = Load(kK3K4);
+  x1 = Fold(x1, k, x2);
+  x1 = Fold(x1, k, x3);
+  x1 = Fold(x1, k, x4);
+  for (; size; ptr += 16, size -= 16) x1 = Fold(x1, k, Load(ptr));
+  // 128 to 64 bits
+  auto mask = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask);
+  x1 = _mm_clmulepi64_si128(x1, _mm_loadl_epi64(
+                                    reinterpret_cast<const __m128i*>(kK5K0)),
+                            0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  // Barrett reduction to 32 bits
+  k = Load(kPoly);
+  x2 = _mm_and_si128(x1, mask);
+  x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+  x2 = _mm_and_si128(x2, mask);
+  x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+std::uint32_t Crc32Pclmul(std::uint32_t crc, const BYTE* ptr,
+                          std::size_t size) {
+  if (size < kBlockSize) return Crc32Zlib(crc, ptr, size);
+  auto folded = size & ~static_cast<std::size_t>(15);
+  crc = ~FoldBlocks(~crc, ptr, folded);
+  return Crc32Zlib(crc, ptr + folded, size - folded);
+}
+
+bool HasPclmul() {
+  int info[4] = {};
+  __cpuid(info, 1);
+  constexpr int kPclmulqdq = 1 << 1;
+  constexpr int kSse41 = 1 << 19;
+  return (info[2] & kPclmulqdq) && (info[2] & kSse41);
+}
+
+#endif  // CRC32_PCLMUL
+
+Crc32Proc SelectCrc32() {
+#ifdef CRC32_PCLMUL
+  if (HasPclmul()) return Crc32Pclmul;
+#endif
+  return Crc32Zlib;
+}
+
+}  // namespace
+
+std::uint32_t Crc32(std::uint32_t crc, const BYTE* ptr, std::size_t size) {
+  static const auto Proc = SelectCrc32();
+  return Proc(crc, ptr, size);
+}
\ No newline at end of file
@@ -0,0 +1,5 @@
+#pragma once
+
+// CRC-32 as zlib crc32() computes it, folded with PCLMULQDQ when the CPU
+// supports it.
+std::uint32_t Crc32(std::uint32_t crc, const BYTE* ptr, std::size_t size);
\ No newline at end of file
@@ -2,21 +2,56 @@
 
 #include "curl_bytestream_adapter.h"
 
-CURLBytestreamAdapter::CURLBytestreamAdapter(curl_write_callback callback)
+#include "sha256_worker.h"
+#include "stats.h"
+#include "trace.h"
+
+CURLBytestreamAdapter::CURLBytestreamAdapter(curl_write_callback callback,
+                                             PVOID callback_data)
     : callback_{callback},
+      callback_data_{callback_data},
       curl_{nullptr},
-      curl_multi_{nullptr, curl_multi_cleanup},
       read_pos_{0},
-      running_count_{0},
       curl_done_{false} {}
 
-bool CURLBytestreamAdapter::Initialize(CURL* curl) {
+namespace {
+
+// must hold at least two writes of CURL_MAX_WRITE_SIZE to make progress
+constexpr std::size_t kMinRingSize = 0x10000;  // 64 KiB
+constexpr int kWaitTimeout = 1000;              // ms
+
+void Notify(HANDLE event, const std::atomic<bool>& waiting) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting) SetEvent(event);
+}
+
+}  // namespace
+
+bool CURLBytestreamAdapter::Initialize(CURL* curl,
+                                       CURLBytestreamOptions* options) {
   assert(curl);
   assert(!curl_);
-  curl_multi_.reset(curl_multi_init());
-  if (!curl_multi_) return false;
-  auto error = curl_multi_add_handle(curl_multi_.get(), curl);
-  if (error != CURLM_OK) return false;
+  max_buffer_ = options->max_buffer;
+  stats_ = options->stats;
+  trace_ = options->trace;
+  sha256_ = options->sha256;
+  if (sha256_) chunk_pool_ = sha256_->pool();
+  assert(!options->shared_loop || options->ring_size);
+  if (options->ring_size) {
+    data_event_.reset(CreateEventA(NULL, FALSE, FALSE, NULL));
+    space_event_.reset(CreateEventA(NULL, FALSE, FALSE, NULL));
+    if (!data_event_ || !space_event_ ||
+        !ring_.Initialize((std::max)(options->ring_size, kMinRingSize))) {
+      std::cerr << "error initializing network thread" << std::endl;
+      return false;
+    }
+    network_thread_ = true;
+    shared_loop_ = options->shared_loop;
+    max_buffer_ = ring_.capacity();
+  }
+  low_water_ = max_buffer_ / 2;
+  if (!shared_loop_ && (!loop_.Initialize() || !loop_.Add(curl)))
+    return false;
   curl_ = curl;  // initialized
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteProc);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
@@ -24,17 +59,43 @@ bool CURLBytestreamAdapter::Initialize(CURL* curl) {
 }
 
 CURLBytestreamAdapter::~CURLBytestreamAdapter() {
+  if (added_) {
+    stop_ = true;
+    shared_loop_->Remove(curl_);
+  }
+  if (thread_.joinable()) {
+    stop_ = true;
+    SetEvent(space_event_.get());
+    thread_.join();
+  }
   if (curl_) {
-    curl_multi_remove_handle(curl_multi_.get(), curl_);
+    if (!shared_loop_) loop_.Remove(curl_);
     ResetCURL();
   }
 }
 
 void CURLBytestreamAdapter::RunToTheEnd() {
-  if (callback_)
-    curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, callback_);
+  chunks_.clear();
+  read_pos_ = 0;
+  if (network_thread_) {
+    // the network thread keeps feeding the hash and the callback only
+    draining_ = true;
+    Start();
+    if (!shared_loop_) {
+      SetEvent(space_event_.get());
+      thread_.join();
+      return;
+    }
+    if (paused_.exchange(false)) shared_loop_->Resume(curl_);
+    while (!producer_done_) WaitForSingleObject(data_event_.get(), INFINITE);
+    return;
+  }
+  buffered_ = 0;
+  if (callback_ || sha256_)
+    draining_ = true;
   else
     ResetCURL();
+  if (paused_) Resume();
   for (auto i = 0u; !curl_done_ && ReadCURL(0 < i); ++i)
     ;
 }
@@ -46,41 +107,78 @@ void CURLBytestreamAdapter::ResetCURL() {
 
 bool CURLBytestreamAdapter::Read(PVOID ptr, std::size_t size,
                                  std::size_t* read) {
+  *read = 0;
   if (done_) return false;
-  auto avail = buffer_.size() - read_pos_;
-  for (auto i = 0u; size && (avail || !curl_done_); ++i) {
-    if (avail) {
-      auto it = reinterpret_cast<PSTR>(ptr);
-      auto read_size = (std::min)(size, avail);
-      for (std::size_t i = 0; i < read_size; ++i) *it++ = buffer_[read_pos_++];
-      ptr = it;
-      size -= read_size;
-      *read += read_size;
-    } else {
-      read_pos_ = 0;
-      buffer_.clear();
-      if (!ReadCURL(0 < i)) curl_done_ = true;
-    }
-    avail = buffer_.size() - read_pos_;
+  PBYTE avail_ptr = nullptr;
+  for (std::size_t avail = 0; size && Peek(&avail_ptr, &avail) && avail;) {
+    auto read_size = (std::min)(size, avail);
+    std::memcpy(ptr, avail_ptr, read_size);
+    Consume(read_size);
+    ptr = reinterpret_cast<PBYTE>(ptr) + read_size;
+    size -= read_size;
+    *read += read_size;
   }
   if (size) done_ = true;
   return true;
 }
 
+bool CURLBytestreamAdapter::Peek(PBYTE* ptr, std::size_t* size) {
+  if (network_thread_) return PeekRing(ptr, size);
+  if (chunks_.empty() && paused_) Resume();
+  if (chunks_.empty() && !curl_done_) {
+    StageTimer timer{stats_, Stats::Stage::kNetworkWait};
+    for (auto i = 0u; chunks_.empty() && !curl_done_; ++i)
+      if (!ReadCURL(0 < i)) curl_done_ = true;
+  }
+  if (chunks_.empty()) {
+    *ptr = nullptr;
+    *size = 0;
+  } else {
+    auto& chunk = chunks_.front();
+    *ptr = chunk->data + read_pos_;
+    *size = chunk->size - read_pos_;
+  }
+  return true;
+}
+
+void CURLBytestreamAdapter::Consume(std::size_t size) {
+  if (network_thread_) return ConsumeRing(size);
+  assert(!chunks_.empty());
+  read_pos_ += size;
+  buffered_ -= size;
+  assert(read_pos_ <= chunks_.front()->size);
+  if (read_pos_ == chunks_.front()->size) {
+    chunks_.pop_front();
+    read_pos_ = 0;
+  }
+  if (paused_ && buffered_ <= low_water_) Resume();
+}
+
+void CURLBytestreamAdapter::Resume() {
+  paused_ = false;
+  // might deliver the held back data right away
+  curl_easy_pause(curl_, CURLPAUSE_CONT);
+}
+
 bool CURLBytestreamAdapter::ReadCURL(bool wait) {
-  if (wait) {
-    auto error = curl_multi_wait(curl_multi_.get(), NULL, 0, 1000, NULL);
-    assert(error == CURLE_OK);
-  }
-  auto error = curl_multi_perform(curl_multi_.get(), &running_count_);
-  if (error != CURLE_OK) return false;
-  auto msgs_in_queue = 0;
-  auto msg = curl_multi_info_read(curl_multi_.get(), &msgs_in_queue);
-  assert(!msgs_in_queue);
-  if (msg) {
-    assert(msg->msg == CURLMSG_DONE);
+  StageTimer timer{stats_, Stats::Stage::kNetwork};
+  auto received = received_;
+  auto ok = false;
+  {
+    // polls don't wait, they'd flood the trace
+    TraceSpan span{wait ? trace_ : nullptr, "network wait"};
+    ok = loop_.RunOnce(wait ? kWaitTimeout : 0);
+  }
+  timer.Add(received_ - received);
+  if (!ok) return false;
+  CURL* curl = nullptr;
+  auto result = CURLE_OK;
+  if (loop_.NextDone(&curl, &result)) {
+    assert(curl == curl_);
     curl_done_ = true;
-    assert(msg->data.result == CURLE_OK);
+    // a dropped connection just ends the stream early
+    if (!stop_ && result != CURLE_OK)
+      std::cerr << "error downloading (code " << result << ')' << std::endl;
   }
   return true;
 }
@@ -90,7 +188,138 @@ std::size_t CURLBytestreamAdapter::WriteProc(PSTR ptr, std::size_t dummy,
   assert(dummy == 1);
   assert(userdata);
   auto this_ = reinterpret_cast<CURLBytestreamAdapter*>(userdata);
-  std::copy(ptr, ptr + size, std::back_inserter(this_->buffer_));
-  if (this_->callback_) this_->callback_(ptr, dummy, size, nullptr);
+  if (this_->stop_) return 0;  // abort the transfer
+  // when paused, libcurl delivers the same data again after resuming
+  auto push = this_->network_thread_ && !this_->draining_;
+  auto append = !this_->network_thread_ && !this_->draining_;
+  if (append) {
+    if (!this_->Append(ptr, size)) return CURL_WRITEFUNC_PAUSE;
+  } else if (push && !this_->Fits(size))
+    return CURL_WRITEFUNC_PAUSE;
+  // appended data is hashed by reference to its chunks, the rest is copied.
+  // Both see the data before the consumer on the other thread does.
+  if (this_->sha256_ && !append) this_->sha256_->Hash(ptr, size);
+  if (this_->callback_)
+    this_->callback_(ptr, dummy, size, this_->callback_data_);
+  if (push) this_->Push(ptr, size);
+  this_->received_ += size;
   return size;
+}
+
+bool CURLBytestreamAdapter::Append(PCSTR ptr, std::size_t size) {
+  if (max_buffer_ && buffered_ && max_buffer_ < buffered_ + size) {
+    paused_ = true;
+    return false;
+  }
+  buffered_ += size;
+  if (peak_buffered_ < buffered_) {
+    peak_buffered_ = buffered_;
+    if (stats_) stats_->Buffered(buffered_);
+  }
+  while (size) {
+    if (chunks_.empty() || chunks_.back()->size == Chunk::kCapacity)
+      chunks_.push_back(chunk_pool_->Allocate());
+    auto& chunk = chunks_.back();
+    auto begin = chunk->size;
+    auto append_size = (std::min)(size, Chunk::kCapacity - begin);
+    std::memcpy(chunk->data + begin, ptr, append_size);
+    chunk->size += append_size;
+    if (sha256_) sha256_->Hash(chunk, begin, chunk->size);
+    ptr += append_size;
+    size -= append_size;
+  }
+  return true;
+}
+
+void CURLBytestreamAdapter::Start() {
+  if (shared_loop_) {
+    if (!added_) shared_loop_->Add(curl_, this);
+    added_ = true;
+  } else if (!thread_.joinable() && !producer_done_)
+    thread_ = std::thread{&CURLBytestreamAdapter::Run, this};
+}
+
+void CURLBytestreamAdapter::Run() {
+  for (auto i = 0u; !curl_done_ && !stop_; ++i) {
+    if (paused_) {
+      // wait for the consumer to drain the ring below the low-water mark
+      producer_waiting_ = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      for (; low_water_ < ring_.size() && !draining_ && !stop_;)
+        WaitForSingleObject(space_event_.get(), INFINITE);
+      producer_waiting_ = false;
+      if (stop_) break;
+      Resume();
+      i = 0;  // resumed transfer has data ready
+    }
+    if (!ReadCURL(0 < i)) break;
+  }
+  producer_done_ = true;
+  SetEvent(data_event_.get());
+}
+
+void CURLBytestreamAdapter::Done(CURLcode result) {
+  curl_done_ = true;
+  // the shared loop runs other transfers too, only the bytes are this one's
+  if (stats_) stats_->Add(Stats::Stage::kNetwork, 0, received_);
+  if (!stop_ && result != CURLE_OK)
+    std::cerr << "error downloading (code " << result << ')' << std::endl;
+  producer_done_ = true;
+  SetEvent(data_event_.get());
+}
+
+bool CURLBytestreamAdapter::Fits(std::size_t size) {
+  // libcurl can't take partial writes back, so either all fits or nothing
+  if (size <= ring_.capacity() - ring_.size()) return true;
+  paused_ = true;
+  if (shared_loop_) {
+    // the consumer might have drained the ring, or started draining the
+    // transfer, before it saw paused_
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto resume = draining_ || ring_.size() <= low_water_;
+    if (resume && paused_.exchange(false))
+      shared_loop_->Resume(curl_);
+  }
+  return false;
+}
+
+void CURLBytestreamAdapter::Push(PCSTR ptr, std::size_t size) {
+  auto written = ring_.Write(ptr, size);
+  assert(written == size);
+  auto buffered = ring_.size();
+  if (peak_buffered_ < buffered) {
+    peak_buffered_ = buffered;
+    if (stats_) stats_->Buffered(buffered);
+  }
+  Notify(data_event_.get(), consumer_waiting_);
+}
+
+bool CURLBytestreamAdapter::PeekRing(PBYTE* ptr, std::size_t* size) {
+  Start();
+  for (;;) {
+    ring_.Peek(ptr, size);
+    if (*size) return true;
+    if (producer_done_) {
+      // data might have been published right before the producer finished
+      ring_.Peek(ptr, size);
+      return true;
+    }
+    consumer_waiting_ = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    ring_.Peek(ptr, size);
+    if (!*size && !producer_done_) {
+      StageTimer timer{stats_, Stats::Stage::kNetworkWait};
+      TraceSpan span{trace_, "network wait"};
+      WaitForSingleObject(data_event_.get(), INFINITE);
+    }
+    consumer_waiting_ = false;
+  }
+}
+
+void CURLBytestreamAdapter::ConsumeRing(std::size_t size) {
+  ring_.Consume(size);
+  if (low_water_ < ring_.size()) return;
+  if (!shared_loop_) return Notify(space_event_.get(), producer_waiting_);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (paused_ && paused_.exchange(false)) shared_loop_->Resume(curl_);
 }
\ No newline at end of file
@@ -1,31 +1,95 @@
 #pragma once
+#include "chunk_pool.h"
+#include "curl_event_loop.h"
+#include "curl_shared_loop.h"
+#include "spsc_ring.h"
 
-class CURLBytestreamAdapter : public IBytestream {
+class SHA256Worker;
+class Stats;
+class Trace;
+
+struct CURLBytestreamOptions {
+  // pause the transfer when this many bytes wait for the consumer,
+  // 0 means no limit
+  std::size_t max_buffer;
+  // non-zero runs the transfer on a dedicated network thread that hands
+  // data over through a ring of that size
+  std::size_t ring_size;
+  // runs the transfer on this loop instead of a network thread of its own,
+  // requires ring_size
+  CURLSharedLoop* shared_loop;
+  // hashes all downloaded data, buffered data by reference, so it must
+  // outlive the adapter, nullptr if not needed
+  SHA256Worker* sha256;
+  Stats* stats;  // nullptr if not needed
+  Trace* trace;  // records waits for data, nullptr if not needed
+};
+
+class CURLBytestreamAdapter : public IBytestream, public ICURLTransfer {
  public:
-  CURLBytestreamAdapter(curl_write_callback callback);
+  // callback sees all downloaded data, with callback_data as userdata
+  CURLBytestreamAdapter(curl_write_callback callback,
+                        PVOID callback_data = nullptr);
   ~CURLBytestreamAdapter();
   CURLBytestreamAdapter(const CURLBytestreamAdapter& other) = delete;
   CURLBytestreamAdapter(CURLBytestreamAdapter&& other) = delete;
   CURLBytestreamAdapter& operator=(const CURLBytestreamAdapter& other) = delete;
   CURLBytestreamAdapter& operator=(CURLBytestreamAdapter&& other) = delete;
 
-  bool Initialize(CURL* curl);
+  bool Initialize(CURL* curl, CURLBytestreamOptions* options);
   void RunToTheEnd();
+  std::size_t peak_buffered() const { return peak_buffered_; }
 
  private:
   void ResetCURL();
   bool Read(PVOID ptr, std::size_t size, std::size_t* read);
+  bool Peek(PBYTE* ptr, std::size_t* size);
+  void Consume(std::size_t size);
   bool ReadCURL(bool wait);
+  bool Append(PCSTR ptr, std::size_t size);
+  void Resume();
+  // network thread mode
+  void Start();
+  void Run();
+  void Done(CURLcode result);
+  bool Fits(std::size_t size);
+  void Push(PCSTR ptr, std::size_t size);
+  bool PeekRing(PBYTE* ptr, std::size_t* size);
+  void ConsumeRing(std::size_t size);
   static std::size_t WriteProc(PSTR ptr, std::size_t dummy, std::size_t size,
                                PVOID userdata);
 
   curl_write_callback callback_;
+  PVOID callback_data_;
   CURL* curl_{nullptr};
-  std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)> curl_multi_{
-      nullptr, curl_multi_cleanup};
-  std::vector<char> buffer_;
-  std::size_t read_pos_{0};
-  int running_count_{0};
+  CURLEventLoop loop_;
+  ChunkPool pool_;
+  ChunkPool* chunk_pool_{&pool_};  // the hash worker's when it references them
+  SHA256Worker* sha256_{nullptr};
+  std::deque<ChunkRef> chunks_;  // received but not consumed yet
+  std::size_t read_pos_{0};      // offset into the front chunk
+  std::size_t buffered_{0};
+  std::size_t max_buffer_{0};
+  std::size_t low_water_{0};  // resume the transfer at this point
+  std::atomic<std::size_t> peak_buffered_{0};
+  Stats* stats_{nullptr};
+  Trace* trace_{nullptr};
+  std::uint64_t received_{0};  // by the thread running the transfer
+  std::atomic<bool> paused_{false};
+  bool network_thread_{false};
+  CURLSharedLoop* shared_loop_{nullptr};
+  bool added_{false};  // to the shared loop
+  SpscRing ring_;
+  std::thread thread_;
+  std::unique_ptr<void, decltype(&CloseHandle)> data_event_{nullptr,
+                                                            CloseHandle};
+  std::unique_ptr<void, decltype(&CloseHandle)> space_event_{nullptr,
+                                                             CloseHandle};
+  std::atomic<bool> consumer_waiting_{false};
+  std::atomic<bool> producer_waiting_{false};  // paused on a full ring
+  std::atomic<bool> producer_done_{false};
+  std::atomic<bool> draining_{false};
+  std::atomic<bool> stop_{false};
   bool curl_done_{false};
   bool done_{false};
 };
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "stdafx.h"
+
+#include "curl_event_loop.h"
+
+CURLEventLoop::~CURLEventLoop() {
+  if (wakeup_ != INVALID_SOCKET) closesocket(wakeup_);
+}
+
+bool CURLEventLoop::Initialize() {
+  assert(!multi_);
+  multi_.reset(curl_multi_init());
+  if (!multi_) return false;
+  auto multi = multi_.get();
+  curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, SocketProc);
+  curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, TimerProc);
+  curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+  return true;
+}
+
+bool CURLEventLoop::EnableWakeup() {
+  assert(wakeup_ == INVALID_SOCKET);
+  // WSAPoll waits on sockets only, so wake it with a datagram sent to a
+  // loopback socket connected to itself
+  auto wakeup = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  auto address_size = static_cast<int>(sizeof(address));
+  auto name = reinterpret_cast<sockaddr*>(&address);
+  u_long nonblocking = 1;
+  auto ok = wakeup != INVALID_SOCKET &&
+            bind(wakeup, name, address_size) != SOCKET_ERROR &&
+            getsockname(wakeup, name, &address_size) != SOCKET_ERROR &&
+            connect(wakeup, name, address_size) != SOCKET_ERROR &&
+            ioctlsocket(wakeup, FIONBIO, &nonblocking) != SOCKET_ERROR;
+  if (!ok) {
+    auto error = WSAGetLastError();
+    if (wakeup != INVALID_SOCKET) closesocket(wakeup);
+    std::cerr << "error creating wakeup socket (code " << error << ')'
+              << std::endl;
+    return false;
+  }
+  wakeup_ = wakeup;
+  fds_.push_back(WSAPOLLFD{wakeup, POLLIN, 0});
+  return true;
+}
+
+void CURLEventLoop::Wakeup() {
+  assert(wakeup_ != INVALID_SOCKET);
+  char byte = 0;
+  send(wakeup_, &byte, 1, 0);
+}
+
+bool CURLEventLoop::Add(CURL* curl) {
+  auto error = curl_multi_add_handle(multi_.get(), curl);
+  if (error == CURLM_OK) return true;
+  std::cerr << "error adding CURL handle (code " << error << ')' << std::endl;
+  return false;
+}
+
+void CURLEventLoop::Remove(CURL* curl) {
+  curl_multi_remove_handle(multi_.get(), curl);
+}
+
+bool CURLEventLoop::RunOnce(int timeout_ms) {
+  auto now = GetTickCount64();
+  if (timer_)
+    timeout_ms = deadline_ <= now
+                     ? 0
+                     : static_cast<int>((std::min)(
+                           deadline_ - now, static_cast<ULONGLONG>(timeout_ms)));
+  if (fds_.empty()) {
+    if (timeout_ms) Sleep(timeout_ms);
+  } else if (WSAPoll(fds_.data(), static_cast<ULONG>(fds_.size()),
+                     timeout_ms) == SOCKET_ERROR) {
+    std::cerr << "error polling sockets (code " << WSAGetLastError() << ')'
+              << std::endl;
+    return false;
+  }
+  // SocketProc may change fds_ while libcurl acts on a socket
+  ready_.clear();
+  for (auto& fd : fds_)
+    if (fd.revents) ready_.push_back(fd);
+  for (auto& fd : ready_) {
+    if (fd.fd == wakeup_) {
+      char buffer[64];
+      while (0 < recv(wakeup_, buffer, sizeof(buffer), 0))
+        ;
+      continue;
+    }
+    auto events = 0;
+    if (fd.revents & (POLLIN | POLLHUP)) events |= CURL_CSELECT_IN;
+    if (fd.revents & POLLOUT) events |= CURL_CSELECT_OUT;
+    if (fd.revents & (POLLERR | POLLNVAL)) events |= CURL_CSELECT_ERR;
+    if (!Action(fd.fd, events)) return false;
+  }
+  if (timer_ && deadline_ <= GetTickCount64()) {
+    timer_ = false;
+    return Action(CURL_SOCKET_TIMEOUT, 0);
+  }
+  return true;
+}
+
+bool CURLEventLoop::NextDone(CURL** curl, CURLcode* result) {
+  auto msgs_in_queue = 0;
+  for (CURLMsg* msg;
+       (msg = curl_multi_info_read(multi_.get(), &msgs_in_queue)) != NULL;) {
+    if (msg->msg != CURLMSG_DONE) continue;
+    *curl = msg->easy_handle;
+    *result = msg->data.result;
+    return true;
+  }
+  return false;
+}
+
+bool CURLEventLoop::Action(curl_socket_t socket, int events) {
+  auto error =
+      curl_multi_socket_action(multi_.get(), socket, events, &running_);
+  if (error == CURLM_OK) return true;
+  std::cerr << "CURL multi error (code " << error << ')' << std::endl;
+  return false;
+}
+
+int CURLEventLoop::SocketProc(CURL* curl, curl_socket_t socket, int what,
+                              PVOID userp, PVOID socketp) {
+  auto this_ = reinterpret_cast<CURLEventLoop*>(userp);
+  auto& fds = this_->fds_;
+  auto it = std::find_if(fds.begin(), fds.end(), [socket](const WSAPOLLFD& fd) {
+    return fd.fd == socket;
+  });
+  if (what == CURL_POLL_REMOVE) {
+    if (it != fds.end()) fds.erase(it);
+    return 0;
+  }
+  if (it == fds.end()) it = fds.insert(fds.end(), WSAPOLLFD{socket, 0, 0});
+  it->events = 0;
+  if (what & CURL_POLL_IN) it->events |= POLLIN;
+  if (what & CURL_POLL_OUT) it->events |= POLLOUT;
+  it->revents = 0;
+  return 0;
+}
+
+int CURLEventLoop::TimerProc(CURLM* multi, long timeout_ms, PVOID userp) {
+  auto this_ = reinterpret_cast<CURLEventLoop*>(userp);
+  this_->timer_ = 0 <= timeout_ms;
+  if (this_->timer_) this_->deadline_ = GetTickCount64() + timeout_ms;
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+// Drives a curl multi handle with curl_multi_socket_action(). Waits on the
+// sockets libcurl registers and fires its timer, so a transfer makes progress
+// as soon as its socket becomes ready. Several transfers can share one loop.
+class CURLEventLoop {
+ public:
+  CURLEventLoop() = default;
+  ~CURLEventLoop();
+  CURLEventLoop(const CURLEventLoop& other) = delete;
+  CURLEventLoop(CURLEventLoop&& other) = delete;
+  CURLEventLoop& operator=(const CURLEventLoop& other) = delete;
+  CURLEventLoop& operator=(CURLEventLoop&& other) = delete;
+
+  bool Initialize();
+  // Lets Wakeup() interrupt RunOnce() from another thread.
+  bool EnableWakeup();
+  void Wakeup();
+  bool Add(CURL* curl);
+  void Remove(CURL* curl);
+  // Waits at most timeout_ms for socket activity or the timer to expire and
+  // lets libcurl act on it.
+  bool RunOnce(int timeout_ms);
+  // Reports the next finished transfer, if any.
+  bool NextDone(CURL** curl, CURLcode* result);
+  int running() const { return running_; }
+
+ private:
+  bool Action(curl_socket_t socket, int events);
+  static int SocketProc(CURL* curl, curl_socket_t socket, int what,
+                        PVOID userp, PVOID socketp);
+  static int TimerProc(CURLM* multi, long timeout_ms, PVOID userp);
+
+  std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)> multi_{
+      nullptr, curl_multi_cleanup};
+  std::vector<WSAPOLLFD> fds_;  // sockets libcurl waits on
+  std::vector<WSAPOLLFD> ready_;
+  SOCKET wakeup_{INVALID_SOCKET};
+  bool timer_{false};
+  ULONGLONG deadline_{0};  // GetTickCount64() based
+  int running_{0};
+};
\ No newline at end of file
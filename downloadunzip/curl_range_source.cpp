@@ -0,0 +1,220 @@
+#include "stdafx.h"
+
+#include "curl_range_source.h"
+
+#include "zip_format.h"
+
+namespace {
+
+// holds the end of central directory record with the longest comment and
+// usually the whole central directory, saving a round trip
+constexpr std::size_t kTailSize =
+    (std::max)(sizeof(std::uint32_t) + sizeof(EndOfCentralDirectoryRecord) +
+                   0xffff,
+               static_cast<std::size_t>(0x40000));  // 256 KiB
+constexpr int kWaitTimeout = 1000;                  // ms
+constexpr long kPartialContent = 206;
+
+std::string FormatRange(std::uint64_t offset, std::uint64_t size) {
+  return std::to_string(offset) + '-' + std::to_string(offset + size - 1);
+}
+
+// Streams a range with a handle of its own.
+class CURLRangeStream : public IBytestream {
+ public:
+  explicit CURLRangeStream(CURL* curl)
+      : curl_{curl, curl_easy_cleanup}, adapter_{nullptr} {}
+  CURLRangeStream(const CURLRangeStream& other) = delete;
+  CURLRangeStream(CURLRangeStream&& other) = delete;
+  CURLRangeStream& operator=(const CURLRangeStream& other) = delete;
+  CURLRangeStream& operator=(CURLRangeStream&& other) = delete;
+
+  bool Initialize(CURLBytestreamOptions* options) {
+    return adapter_.Initialize(curl_.get(), options);
+  }
+
+ private:
+  bool Read(PVOID ptr, std::size_t size, std::size_t* read) {
+    return stream()->Read(ptr, size, read);
+  }
+  bool Peek(PBYTE* ptr, std::size_t* size) { return stream()->Peek(ptr, size); }
+  void Consume(std::size_t size) { stream()->Consume(size); }
+  IBytestream* stream() { return &adapter_; }
+
+  std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl_;
+  CURLBytestreamAdapter adapter_;  // goes away before the handle it drives
+};
+
+}  // namespace
+
+CURLRangeSource::~CURLRangeSource() {
+  for (auto& transfer : transfers_) loop_.Remove(transfer->curl.get());
+}
+
+bool CURLRangeSource::Initialize(CURL* curl, unsigned count,
+                                 CURLBytestreamOptions* options) {
+  assert(curl);
+  assert(!curl_);
+  assert(count);
+  if (!loop_.Initialize()) return false;
+  curl_ = curl;  // initialized
+  options_ = *options;
+  for (auto i = 0u; i < count; ++i) {
+    auto duplicate = Duplicate();
+    if (!duplicate) return false;
+    transfers_.emplace_back(new Transfer{
+        this, {duplicate, curl_easy_cleanup}, 0, 0, std::vector<BYTE>{}});
+    auto transfer = transfers_.back().get();
+    curl_easy_setopt(duplicate, CURLOPT_PRIVATE, transfer);
+    curl_easy_setopt(duplicate, CURLOPT_WRITEFUNCTION, WriteProc);
+    curl_easy_setopt(duplicate, CURLOPT_WRITEDATA, transfer);
+    idle_.push_back(transfer);
+  }
+  // the tail also tells whether the server honors Range requests at all
+  auto transfer = idle_.back();
+  idle_.pop_back();
+  auto tail_curl = transfer->curl.get();
+  curl_easy_setopt(tail_curl, CURLOPT_HEADERFUNCTION, HeaderProc);
+  curl_easy_setopt(tail_curl, CURLOPT_HEADERDATA, transfer);
+  auto range = '-' + std::to_string(kTailSize);
+  std::size_t tag = 0;
+  auto ok = Start(transfer, range.c_str(), 0, 0) && Wait(&tag, &tail_);
+  curl_easy_setopt(tail_curl, CURLOPT_HEADERFUNCTION, NULL);
+  return ok;
+}
+
+bool CURLRangeSource::ReadTail(std::uint64_t* offset,
+                               std::vector<BYTE>* data) {
+  *offset = tail_offset_;
+  *data = tail_;
+  return true;
+}
+
+bool CURLRangeSource::Request(std::uint64_t offset, std::size_t size,
+                              std::size_t tag) {
+  assert(size);
+  if (idle_.empty()) {
+    pending_.push_back(PendingRequest{offset, size, tag});
+    return true;
+  }
+  auto transfer = idle_.back();
+  idle_.pop_back();
+  return Start(transfer, FormatRange(offset, size).c_str(), size, tag);
+}
+
+bool CURLRangeSource::Wait(std::size_t* tag, std::vector<BYTE>* data) {
+  assert(idle_.size() < transfers_.size());
+  CURL* curl = nullptr;
+  auto result = CURLE_OK;
+  while (!loop_.NextDone(&curl, &result))
+    if (!loop_.RunOnce(kWaitTimeout)) return false;
+  Transfer* transfer = nullptr;
+  if (!Finish(curl, result, &transfer)) return false;
+  *tag = transfer->tag;
+  *data = std::move(transfer->data);
+  // keep every transfer busy
+  if (pending_.empty()) return true;
+  auto request = pending_.front();
+  pending_.pop_front();
+  return Request(request.offset, request.size, request.tag);
+}
+
+std::unique_ptr<IBytestream> CURLRangeSource::Stream(std::uint64_t offset,
+                                                     std::uint64_t size) {
+  assert(size);
+  auto curl = Duplicate();
+  if (!curl) return nullptr;
+  auto stream = std::make_unique<CURLRangeStream>(curl);
+  curl_easy_setopt(curl, CURLOPT_RANGE, FormatRange(offset, size).c_str());
+  if (!stream->Initialize(&options_)) return nullptr;
+  return std::move(stream);
+}
+
+CURL* CURLRangeSource::Duplicate() {
+  auto curl = curl_easy_duphandle(curl_);
+  if (!curl) {
+    std::cerr << "error initializing CURL" << std::endl;
+    return nullptr;
+  }
+  // a duplicate starts without cookies, hand over the ones received so far
+  curl_slist* cookies = nullptr;
+  if (curl_easy_getinfo(curl_, CURLINFO_COOKIELIST, &cookies) == CURLE_OK) {
+    for (auto it = cookies; it; it = it->next)
+      curl_easy_setopt(curl, CURLOPT_COOKIELIST, it->data);
+    curl_slist_free_all(cookies);
+  }
+  return curl;
+}
+
+bool CURLRangeSource::Start(Transfer* transfer, PCSTR range, std::size_t size,
+                            std::size_t tag) {
+  transfer->tag = tag;
+  transfer->size = size;
+  transfer->data.clear();
+  transfer->data.reserve(size);
+  curl_easy_setopt(transfer->curl.get(), CURLOPT_RANGE, range);
+  if (loop_.Add(transfer->curl.get())) return true;
+  idle_.push_back(transfer);
+  return false;
+}
+
+bool CURLRangeSource::Finish(CURL* curl, CURLcode result,
+                             Transfer** transfer) {
+  PSTR private_data = nullptr;
+  curl_easy_getinfo(curl, CURLINFO_PRIVATE, &private_data);
+  *transfer = reinterpret_cast<Transfer*>(private_data);
+  loop_.Remove(curl);
+  idle_.push_back(*transfer);
+  long code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  if (code == 200) {
+    // WriteProc stopped the transfer rather than take the whole archive
+    ranges_supported_ = false;
+    return false;
+  }
+  if (result != CURLE_OK) {
+    std::cerr << "error downloading range (code " << result << ')'
+              << std::endl;
+    return false;
+  }
+  if (code != kPartialContent) {
+    std::cerr << "HTTP error (code " << code << ')' << std::endl;
+    return false;
+  }
+  auto size = (*transfer)->size;
+  if (!size || size == (*transfer)->data.size()) return true;
+  std::cerr << "unexpected range size " << (*transfer)->data.size()
+            << ", expected " << size << std::endl;
+  return false;
+}
+
+std::size_t CURLRangeSource::WriteProc(PSTR ptr, std::size_t dummy,
+                                       std::size_t size, PVOID userdata) {
+  assert(dummy == 1);
+  assert(userdata);
+  auto transfer = reinterpret_cast<Transfer*>(userdata);
+  auto& data = transfer->data;
+  if (data.empty()) {
+    long code = 0;
+    curl_easy_getinfo(transfer->curl.get(), CURLINFO_RESPONSE_CODE, &code);
+    if (code != kPartialContent) return 0;  // abort the transfer
+  }
+  if (transfer->size && transfer->size < data.size() + size) return 0;
+  data.insert(data.end(), ptr, ptr + size);
+  return size;
+}
+
+std::size_t CURLRangeSource::HeaderProc(PSTR ptr, std::size_t dummy,
+                                        std::size_t size, PVOID userdata) {
+  assert(dummy == 1);
+  assert(userdata);
+  // Content-Range: bytes first-last/length
+  constexpr char kContentRange[] = "content-range: bytes ";
+  constexpr auto kContentRangeLen = sizeof(kContentRange) - 1;
+  if (size <= kContentRangeLen ||
+      _strnicmp(ptr, kContentRange, kContentRangeLen))
+    return size;
+  auto transfer = reinterpret_cast<Transfer*>(userdata);
+  transfer->source->tail_offset_ = strtoull(ptr + kContentRangeLen, NULL, 10);
+  return size;
+}
\ No newline at end of file
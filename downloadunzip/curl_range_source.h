@@ -0,0 +1,61 @@
+#pragma once
+#include "curl_bytestream_adapter.h"
+#include "curl_event_loop.h"
+
+// Reads byte ranges of the archive at a URL with several concurrent Range
+// requests sharing one event loop, so a high-latency link is not limited to
+// the throughput of a single connection.
+class CURLRangeSource : public IRangeSource {
+ public:
+  CURLRangeSource() = default;
+  ~CURLRangeSource();
+  CURLRangeSource(const CURLRangeSource& other) = delete;
+  CURLRangeSource(CURLRangeSource&& other) = delete;
+  CURLRangeSource& operator=(const CURLRangeSource& other) = delete;
+  CURLRangeSource& operator=(CURLRangeSource&& other) = delete;
+
+  // Reads the tail of the archive at the URL set on curl. Each of the count
+  // transfers is a duplicate of curl with the cookies it holds. Ranges too
+  // big to be read in one go are streamed with options.
+  bool Initialize(CURL* curl, unsigned count, CURLBytestreamOptions* options);
+  // false if the server ignores Range requests
+  bool ranges_supported() const { return ranges_supported_; }
+
+ private:
+  struct Transfer {
+    CURLRangeSource* source;
+    std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl;
+    std::size_t tag;
+    std::size_t size;  // expected, 0 if unknown
+    std::vector<BYTE> data;
+  };
+  struct PendingRequest {
+    std::uint64_t offset;
+    std::size_t size;
+    std::size_t tag;
+  };
+
+  bool ReadTail(std::uint64_t* offset, std::vector<BYTE>* data);
+  bool Request(std::uint64_t offset, std::size_t size, std::size_t tag);
+  bool Wait(std::size_t* tag, std::vector<BYTE>* data);
+  std::unique_ptr<IBytestream> Stream(std::uint64_t offset,
+                                      std::uint64_t size);
+  CURL* Duplicate();
+  bool Start(Transfer* transfer, PCSTR range, std::size_t size,
+             std::size_t tag);
+  bool Finish(CURL* curl, CURLcode result, Transfer** transfer);
+  static std::size_t WriteProc(PSTR ptr, std::size_t dummy, std::size_t size,
+                               PVOID userdata);
+  static std::size_t HeaderProc(PSTR ptr, std::size_t dummy, std::size_t size,
+                                PVOID userdata);
+
+  CURL* curl_{nullptr};
+  CURLBytestreamOptions options_{};
+  CURLEventLoop loop_;
+  std::vector<std::unique_ptr<Transfer>> transfers_;
+  std::vector<Transfer*> idle_;
+  std::deque<PendingRequest> pending_;
+  std::uint64_t tail_offset_{0};
+  std::vector<BYTE> tail_;
+  bool ranges_supported_{true};
+};
\ No newline at end of file
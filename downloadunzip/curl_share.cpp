@@ -0,0 +1,38 @@
+#include "stdafx.h"
+
+#include "curl_share.h"
+
+bool CURLShare::Initialize() {
+  assert(!share_);
+  share_.reset(curl_share_init());
+  if (!share_) {
+    std::cerr << "error initializing CURL share" << std::endl;
+    return false;
+  }
+  auto share = share_.get();
+  curl_share_setopt(share, CURLSHOPT_LOCKFUNC, LockProc);
+  curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, UnlockProc);
+  curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  // connections are left to the multi handle, which multiplexes them, TLS
+  // sessions still spare full handshakes to hosts seen by other handles
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  return true;
+}
+
+void CURLShare::Attach(CURL* curl) {
+  assert(share_);
+  curl_easy_setopt(curl, CURLOPT_SHARE, share_.get());
+}
+
+void CURLShare::LockProc(CURL* curl, curl_lock_data data,
+                         curl_lock_access access, PVOID userptr) {
+  auto this_ = reinterpret_cast<CURLShare*>(userptr);
+  this_->mutexes_[data].lock();
+}
+
+void CURLShare::UnlockProc(CURL* curl, curl_lock_data data, PVOID userptr) {
+  auto this_ = reinterpret_cast<CURLShare*>(userptr);
+  this_->mutexes_[data].unlock();
+}
\ No newline at end of file
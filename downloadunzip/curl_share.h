@@ -0,0 +1,25 @@
+#pragma once
+
+// Shares cookies, DNS cache and TLS sessions between easy handles, which may
+// be used on different threads.
+class CURLShare {
+ public:
+  CURLShare() = default;
+  CURLShare(const CURLShare& other) = delete;
+  CURLShare(CURLShare&& other) = delete;
+  CURLShare& operator=(const CURLShare& other) = delete;
+  CURLShare& operator=(CURLShare&& other) = delete;
+
+  bool Initialize();
+  // Makes curl use the shared data.
+  void Attach(CURL* curl);
+
+ private:
+  static void LockProc(CURL* curl, curl_lock_data data,
+                       curl_lock_access access, PVOID userptr);
+  static void UnlockProc(CURL* curl, curl_lock_data data, PVOID userptr);
+
+  std::unique_ptr<CURLSH, decltype(&curl_share_cleanup)> share_{
+      nullptr, curl_share_cleanup};
+  std::mutex mutexes_[CURL_LOCK_DATA_LAST];
+};
\ No newline at end of file
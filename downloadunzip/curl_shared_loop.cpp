@@ -0,0 +1,124 @@
+#include "stdafx.h"
+
+#include "curl_shared_loop.h"
+
+#include "stats.h"
+
+namespace {
+
+constexpr int kWaitTimeout = 1000;  // ms
+
+}  // namespace
+
+CURLSharedLoop::~CURLSharedLoop() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  loop_.Wakeup();
+  thread_.join();
+  assert(transfers_.empty());
+}
+
+bool CURLSharedLoop::Initialize(Stats* stats) {
+  assert(!thread_.joinable());
+  stats_ = stats;
+  if (!loop_.Initialize() || !loop_.EnableWakeup()) return false;
+  thread_ = std::thread{&CURLSharedLoop::Run, this};
+  return true;
+}
+
+void CURLSharedLoop::Add(CURL* curl, ICURLTransfer* transfer) {
+  Post(Command::kAdd, curl, transfer);
+}
+
+void CURLSharedLoop::Resume(CURL* curl) {
+  Post(Command::kResume, curl, nullptr);
+}
+
+void CURLSharedLoop::Remove(CURL* curl) {
+  auto ticket = Post(Command::kRemove, curl, nullptr);
+  std::unique_lock<std::mutex> lock{mutex_};
+  processed_cv_.wait(lock, [this, ticket] { return ticket <= processed_; });
+}
+
+std::uint64_t CURLSharedLoop::Post(Command command, CURL* curl,
+                                   ICURLTransfer* transfer) {
+  std::uint64_t ticket = 0;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    requests_.push_back(Request{command, curl, transfer});
+    ticket = ++posted_;
+  }
+  loop_.Wakeup();
+  return ticket;
+}
+
+void CURLSharedLoop::Run() {
+  for (;;) {
+    if (!RunRequests()) break;
+    auto ok = false;
+    {
+      StageTimer timer{stats_, Stats::Stage::kNetwork};
+      ok = loop_.RunOnce(kWaitTimeout);
+    }
+    if (!ok) {
+      // fail everything rather than spin on a broken poll
+      while (!transfers_.empty())
+        Finish(transfers_.begin()->first, CURLE_RECV_ERROR);
+      continue;
+    }
+    CURL* curl = nullptr;
+    auto result = CURLE_OK;
+    while (loop_.NextDone(&curl, &result)) Finish(curl, result);
+  }
+}
+
+bool CURLSharedLoop::RunRequests() {
+  std::vector<Request> requests;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (stop_) return false;
+    requests.swap(requests_);
+  }
+  for (auto& request : requests) {
+    auto curl = request.curl;
+    auto it = transfers_.find(curl);
+    switch (request.command) {
+      case Command::kAdd:
+        assert(it == transfers_.end());
+        if (!loop_.Add(curl)) {
+          request.transfer->Done(CURLE_FAILED_INIT);
+          break;
+        }
+        transfers_.emplace(curl, request.transfer);
+        break;
+      case Command::kResume:
+        // might deliver the held back data right away
+        if (it != transfers_.end()) curl_easy_pause(curl, CURLPAUSE_CONT);
+        break;
+      case Command::kRemove:
+        if (it == transfers_.end()) break;  // finished already
+        loop_.Remove(curl);
+        transfers_.erase(it);
+        break;
+    }
+  }
+  if (requests.empty()) return true;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    processed_ += requests.size();
+  }
+  processed_cv_.notify_all();
+  return true;
+}
+
+void CURLSharedLoop::Finish(CURL* curl, CURLcode result) {
+  auto it = transfers_.find(curl);
+  assert(it != transfers_.end());
+  auto transfer = it->second;
+  transfers_.erase(it);
+  loop_.Remove(curl);
+  transfer->Done(result);
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+#include "curl_event_loop.h"
+
+class Stats;
+
+// A transfer run by CURLSharedLoop.
+struct ICURLTransfer {
+  virtual ~ICURLTransfer() = default;
+  // Called on the network thread once the transfer ends.
+  virtual void Done(CURLcode result) = 0;
+};
+
+// Runs the transfers of several consumers on one multi handle driven by one
+// network thread. Transfers to the same host share its connections and are
+// multiplexed over one connection with HTTP/2. The multi handle is used on the
+// network thread only, other threads post commands to it.
+class CURLSharedLoop {
+ public:
+  CURLSharedLoop() = default;
+  ~CURLSharedLoop();
+  CURLSharedLoop(const CURLSharedLoop& other) = delete;
+  CURLSharedLoop(CURLSharedLoop&& other) = delete;
+  CURLSharedLoop& operator=(const CURLSharedLoop& other) = delete;
+  CURLSharedLoop& operator=(CURLSharedLoop&& other) = delete;
+
+  // time running the transfers is counted to stats unless it's nullptr,
+  // their bytes are counted by their consumers
+  bool Initialize(Stats* stats = nullptr);
+  // Starts the transfer, transfer->Done() is called when it ends.
+  void Add(CURL* curl, ICURLTransfer* transfer);
+  // Unpauses a transfer paused by its write callback.
+  void Resume(CURL* curl);
+  // Waits until the transfer is removed, its callbacks aren't called after.
+  void Remove(CURL* curl);
+
+ private:
+  enum class Command { kAdd, kResume, kRemove };
+  struct Request {
+    Command command;
+    CURL* curl;
+    ICURLTransfer* transfer;
+  };
+
+  std::uint64_t Post(Command command, CURL* curl, ICURLTransfer* transfer);
+  void Run();
+  bool RunRequests();
+  void Finish(CURL* curl, CURLcode result);
+
+  CURLEventLoop loop_;
+  Stats* stats_{nullptr};
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable processed_cv_;
+  std::vector<Request> requests_;
+  std::uint64_t posted_{0};
+  std::uint64_t processed_{0};
+  bool stop_{false};
+  // network thread only
+  std::unordered_map<CURL*, ICURLTransfer*> transfers_;
+};
\ No newline at end of file
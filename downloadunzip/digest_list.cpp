@@ -0,0 +1,41 @@
+#include "stdafx.h"
+
+#include "digest_list.h"
+
+void DigestList::Add(PCSTR name, const BYTE (&digest)[32]) {
+  constexpr char kHexDigits[] = "0123456789abcdef";
+  std::string hex(sizeof(digest) * 2, '0');
+  for (std::size_t i = 0; i < sizeof(digest); ++i) {
+    hex[i * 2] = kHexDigits[digest[i] >> 4];
+    hex[i * 2 + 1] = kHexDigits[digest[i] & 0xf];
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  items_.emplace_back(name, std::move(hex));
+}
+
+bool DigestList::Save() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  // entries finish out of order with worker threads
+  std::sort(items_.begin(), items_.end());
+  std::string text;
+  for (auto& item : items_) {
+    text += item.second;
+    text += "  ";
+    text += item.first;
+    text += '\n';
+  }
+  auto file = CreateFileA(path_, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                          FILE_ATTRIBUTE_NORMAL, NULL);
+  auto ok = file != INVALID_HANDLE_VALUE;
+  if (ok) {
+    DWORD written = 0;
+    ok = WriteFile(file, text.data(), static_cast<DWORD>(text.size()),
+                   &written, NULL) &&
+         written == text.size();
+    CloseHandle(file);
+  }
+  if (ok) return true;
+  std::cerr << "error writing digest file " << path_ << " (code "
+            << GetLastError() << ')' << std::endl;
+  return false;
+}
\ No newline at end of file
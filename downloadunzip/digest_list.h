@@ -0,0 +1,22 @@
+#pragma once
+
+// SHA-256 digests of extracted entries, --entry-sha256 mode. Saved sorted by
+// name, in the format "sha256sum -c" checks.
+class DigestList {
+ public:
+  DigestList() = default;
+  DigestList(const DigestList& other) = delete;
+  DigestList(DigestList&& other) = delete;
+  DigestList& operator=(const DigestList& other) = delete;
+  DigestList& operator=(DigestList&& other) = delete;
+
+  void Initialize(PCSTR path) { path_ = path; }
+  // Safe to call from several threads.
+  void Add(PCSTR name, const BYTE (&digest)[32]);
+  bool Save();
+
+ private:
+  PCSTR path_{nullptr};
+  std::mutex mutex_;
+  std::vector<std::pair<std::string, std::string>> items_;  // name, digest
+};
\ No newline at end of file
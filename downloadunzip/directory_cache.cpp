@@ -0,0 +1,39 @@
+#include "stdafx.h"
+
+#include "directory_cache.h"
+
+bool DirectoryCache::Create(PCSTR path, std::size_t existing_size) {
+  std::string directory{path};
+  auto end = directory.find_last_of("/\\");
+  if (end == std::string::npos || end < existing_size) return true;
+  directory.resize(end);
+  // start below the deepest directory known to exist
+  auto begin = existing_size;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    for (auto size = directory.size(); existing_size < size;) {
+      if (known_.count(directory.substr(0, size))) {
+        begin = size + 1;
+        break;
+      }
+      size = directory.find_last_of("/\\", size - 1);
+      if (size == std::string::npos) break;
+    }
+  }
+  // other threads may be creating the same directories
+  std::vector<std::string> created;
+  for (auto i = begin; i <= directory.size(); ++i) {
+    i = (std::min)(directory.find_first_of("/\\", i), directory.size());
+    created.push_back(directory.substr(0, i));
+    auto succeeded = CreateDirectoryA(created.back().c_str(), NULL);
+    auto error = GetLastError();
+    if (!succeeded && error != ERROR_ALREADY_EXISTS) {
+      std::cerr << "error creating directory " << created.back() << " (code "
+                << error << ')' << std::endl;
+      return false;
+    }
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  for (auto& it : created) known_.insert(std::move(it));
+  return true;
+}
\ No newline at end of file
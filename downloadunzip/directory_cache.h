@@ -0,0 +1,22 @@
+#pragma once
+
+// Directories known to exist, shared by the threads extracting files. Each
+// directory is created once, files in known directories are created without
+// touching their parents.
+class DirectoryCache {
+ public:
+  DirectoryCache() = default;
+  DirectoryCache(const DirectoryCache& other) = delete;
+  DirectoryCache(DirectoryCache&& other) = delete;
+  DirectoryCache& operator=(const DirectoryCache& other) = delete;
+  DirectoryCache& operator=(DirectoryCache&& other) = delete;
+
+  // Creates the directories in path up to its last slash, the first
+  // existing_size characters name a directory that exists already. Safe to
+  // call from several threads.
+  bool Create(PCSTR path, std::size_t existing_size);
+
+ private:
+  std::mutex mutex_;
+  std::unordered_set<std::string> known_;
+};
\ No newline at end of file
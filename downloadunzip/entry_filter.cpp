@@ -0,0 +1,52 @@
+#include "stdafx.h"
+
+#include "entry_filter.h"
+
+namespace {
+
+inline bool IsSeparator(char ch) { return ch == '/' || ch == '\\'; }
+
+inline bool SameChar(char a, char b) {
+  if (IsSeparator(a)) return IsSeparator(b);
+  return tolower(static_cast<unsigned char>(a)) ==
+         tolower(static_cast<unsigned char>(b));
+}
+
+// begin is where the whole pattern starts.
+bool Match(PCSTR begin, PCSTR pattern, PCSTR name) {
+  for (; *pattern; ++pattern, ++name) {
+    if (*pattern == '*') {
+      auto across = pattern[1] == '*';
+      auto component = pattern == begin || IsSeparator(pattern[-1]);
+      for (; *pattern == '*'; ++pattern)
+        ;
+      // a whole "**/" component matches no directory at all too
+      if (across && component && IsSeparator(*pattern) &&
+          Match(begin, pattern + 1, name))
+        return true;
+      // try every split, a '*' stops at the end of a path component
+      for (;; ++name) {
+        if (Match(begin, pattern, name)) return true;
+        if (!*name || (!across && IsSeparator(*name))) return false;
+      }
+    }
+    if (!*name) return false;
+    if (*pattern == '?') {
+      if (IsSeparator(*name)) return false;
+    } else if (!SameChar(*pattern, *name))
+      return false;
+  }
+  return !*name;
+}
+
+bool MatchAny(const std::vector<PCSTR>& patterns, PCSTR name) {
+  return std::any_of(patterns.begin(), patterns.end(),
+                     [name](PCSTR pattern) { return Match(pattern, pattern, name); });
+}
+
+}  // namespace
+
+bool EntryFilter::Matches(PCSTR name) const {
+  if (!include_.empty() && !MatchAny(include_, name)) return false;
+  return !MatchAny(exclude_, name);
+}
\ No newline at end of file
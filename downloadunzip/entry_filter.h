@@ -0,0 +1,24 @@
+#pragma once
+
+// Selects entries by name with glob patterns. '*' and '?' don't match '/',
+// '**' matches across directories and "a/**/b" matches "a/b" too. Case is
+// ignored and '\' matches '/'.
+// An entry is selected if it matches any include pattern, or there are none,
+// and no exclude pattern.
+class EntryFilter {
+ public:
+  EntryFilter() = default;
+  EntryFilter(const EntryFilter& other) = delete;
+  EntryFilter(EntryFilter&& other) = delete;
+  EntryFilter& operator=(const EntryFilter& other) = delete;
+  EntryFilter& operator=(EntryFilter&& other) = delete;
+
+  void Include(PCSTR pattern) { include_.push_back(pattern); }
+  void Exclude(PCSTR pattern) { exclude_.push_back(pattern); }
+  bool empty() const { return include_.empty() && exclude_.empty(); }
+  bool Matches(PCSTR name) const;
+
+ private:
+  std::vector<PCSTR> include_;
+  std::vector<PCSTR> exclude_;
+};
\ No newline at end of file
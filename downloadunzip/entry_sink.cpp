@@ -0,0 +1,212 @@
+#include "stdafx.h"
+
+#include "entry_sink.h"
+
+#include "directory_cache.h"
+#include "file_sink.h"
+
+namespace {
+
+constexpr std::size_t kBlockSize = 0x100000;  // 1 MiB
+// larger entries get a block of their own
+constexpr std::size_t kMaxSharedSize = kBlockSize / 4;
+// largest file mapped in one view, larger ones are written. A 32-bit address
+// space rarely has room for a contiguous view much larger.
+#ifdef _WIN64
+constexpr std::uint64_t kMaxMapSize = 0x10000000000;  // 1 TiB
+#else
+constexpr std::uint64_t kMaxMapSize = 0x40000000;  // 1 GiB
+#endif
+
+class FileEntrySink : public IEntrySink {
+ public:
+  FileEntrySink(std::unique_ptr<IFileSink>&& sink, bool overwrite, bool times,
+                std::uint64_t map_size, DirectoryCache* directories)
+      : sink_{std::move(sink)},
+        overwrite_{overwrite},
+        times_{times},
+        map_size_{map_size},
+        directories_{directories} {}
+  FileEntrySink(const FileEntrySink& other) = delete;
+  FileEntrySink(FileEntrySink&& other) = delete;
+  FileEntrySink& operator=(const FileEntrySink& other) = delete;
+  FileEntrySink& operator=(FileEntrySink&& other) = delete;
+
+  bool OnEntryBegin(const EntryInfo& entry) override {
+    size_ = entry.uncompressed_size;
+    // the destination directory exists already
+    auto existing_size = static_cast<std::size_t>(entry.name - entry.path);
+    if (!entry.directory)
+      return sink_->Create(entry.path, existing_size, overwrite_, size_);
+    if (directories_) return directories_->Create(entry.path, existing_size);
+    auto ok = CreateDirectoryA(entry.path, NULL);
+    auto error = GetLastError();
+    if (ok || error == ERROR_ALREADY_EXISTS) return true;
+    std::cerr << "error creating directory " << entry.path << " (code "
+              << error << ')' << std::endl;
+    return false;
+  }
+
+  bool Map(PBYTE* view) override {
+    *view = nullptr;
+    // large files are mapped and written in place, up to what a view holds
+    if (!map_size_ || size_ < map_size_ || kMaxMapSize < size_) return true;
+    *view = sink_->Map();
+    return *view != nullptr;
+  }
+
+  bool OnData(const BYTE* ptr, std::size_t size) override {
+    return sink_->Write(ptr, size);
+  }
+
+  bool OnEntryEnd(const EntryInfo& entry) override {
+    // 0 leaves the time of the write
+    return entry.directory || sink_->Close(times_ ? entry.filetime : 0);
+  }
+
+  bool Flush() override { return sink_->Flush(); }
+
+ private:
+  std::unique_ptr<IFileSink> sink_;
+  bool overwrite_;
+  bool times_;
+  std::uint64_t map_size_;
+  DirectoryCache* directories_;
+  std::uint64_t size_{0};  // of the entry being written
+};
+
+class MemoryEntrySink : public IEntrySink {
+ public:
+  explicit MemoryEntrySink(MemoryEntrySinkFactory* factory)
+      : factory_{factory} {}
+  MemoryEntrySink(const MemoryEntrySink& other) = delete;
+  MemoryEntrySink(MemoryEntrySink&& other) = delete;
+  MemoryEntrySink& operator=(const MemoryEntrySink& other) = delete;
+  MemoryEntrySink& operator=(MemoryEntrySink&& other) = delete;
+
+  bool OnEntryBegin(const EntryInfo& entry) override {
+    data_ = nullptr;
+    size_ = 0;
+    used_ = 0;
+    buffer_.clear();
+    // entries of unknown size are buffered and moved to the arena at the end
+    known_ = entry.uncompressed_size != EntryInfo::kUnknownSize;
+    if (entry.directory || !known_) return true;
+    if (SIZE_MAX < entry.uncompressed_size) {
+      std::cerr << "entry " << entry.name << " doesn't fit in memory"
+                << std::endl;
+      return false;
+    }
+    size_ = static_cast<std::size_t>(entry.uncompressed_size);
+    data_ = factory_->Allocate(size_);
+    return true;
+  }
+
+  bool Map(PBYTE* view) override {
+    *view = data_;
+    used_ = size_;
+    return true;
+  }
+
+  bool OnData(const BYTE* ptr, std::size_t size) override {
+    if (!known_) {
+      buffer_.insert(buffer_.end(), ptr, ptr + size);
+      return true;
+    }
+    if (size_ - used_ < size) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;  // more than the entry size
+    }
+    std::memcpy(data_ + used_, ptr, size);
+    used_ += size;
+    return true;
+  }
+
+  bool OnEntryEnd(const EntryInfo& entry) override {
+    if (!known_) {
+      size_ = buffer_.size();
+      data_ = factory_->Allocate(size_);
+      if (size_) std::memcpy(data_, buffer_.data(), size_);
+    }
+    factory_->Add(MemoryEntrySinkFactory::Entry{
+        entry.name, entry.directory, data_, size_, entry.crc32,
+        entry.filetime});
+    return true;
+  }
+
+  bool Flush() override { return true; }
+
+ private:
+  MemoryEntrySinkFactory* factory_;
+  PBYTE data_{nullptr};  // of the entry, in the arena
+  std::size_t size_{0};
+  std::size_t used_{0};
+  bool known_{false};  // the size of the entry
+  std::vector<BYTE> buffer_;
+};
+
+class DiscardEntrySink : public IEntrySink {
+ public:
+  bool OnEntryBegin(const EntryInfo& entry) override { return true; }
+  bool Map(PBYTE* view) override {
+    *view = nullptr;
+    return true;
+  }
+  bool OnData(const BYTE* ptr, std::size_t size) override { return true; }
+  bool OnEntryEnd(const EntryInfo& entry) override { return true; }
+  bool Flush() override { return true; }
+};
+
+}  // namespace
+
+void FileEntrySinkFactory::Initialize(bool overwrite, bool times,
+                                      unsigned buffers, bool preallocate,
+                                      std::uint64_t map_size,
+                                      DirectoryCache* directories,
+                                      FilePool* pool, Stats* stats) {
+  overwrite_ = overwrite;
+  times_ = times;
+  buffers_ = buffers;
+  preallocate_ = preallocate;
+  map_size_ = map_size;
+  directories_ = directories;
+  pool_ = pool;
+  stats_ = stats;
+}
+
+std::unique_ptr<IEntrySink> FileEntrySinkFactory::Create() {
+  return std::make_unique<FileEntrySink>(
+      CreateFileSink(buffers_, preallocate_, directories_, pool_, stats_),
+      overwrite_, times_, map_size_, directories_);
+}
+
+std::unique_ptr<IEntrySink> MemoryEntrySinkFactory::Create() {
+  return std::make_unique<MemoryEntrySink>(this);
+}
+
+PBYTE MemoryEntrySinkFactory::Allocate(std::size_t size) {
+  if (!size) return nullptr;
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (kMaxSharedSize < size) {
+    blocks_.emplace_back(new BYTE[size]);
+    return blocks_.back().get();
+  }
+  if (available_ < size) {
+    blocks_.emplace_back(new BYTE[kBlockSize]);
+    next_ = blocks_.back().get();
+    available_ = kBlockSize;
+  }
+  auto ptr = next_;
+  next_ += size;
+  available_ -= size;
+  return ptr;
+}
+
+void MemoryEntrySinkFactory::Add(Entry&& entry) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  entries_.push_back(std::move(entry));
+}
+
+std::unique_ptr<IEntrySink> DiscardEntrySinkFactory::Create() {
+  return std::make_unique<DiscardEntrySink>();
+}
\ No newline at end of file
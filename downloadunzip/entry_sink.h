@@ -0,0 +1,111 @@
+#pragma once
+
+class DirectoryCache;
+class FilePool;
+class Stats;
+
+// An archive entry as extraction goes through it.
+struct EntryInfo {
+  static constexpr std::uint64_t kUnknownSize = UINT64_MAX;
+
+  PCSTR path;  // name prefixed with the destination directory
+  PCSTR name;  // as in the archive, points into path
+  bool directory;  // the name ends with a slash, the entry has no data
+  std::uint16_t method;
+  // kUnknownSize until the end of the entry if a data descriptor follows it
+  std::uint64_t compressed_size;
+  std::uint64_t uncompressed_size;
+  std::uint32_t crc32;  // 0 until the end if a data descriptor follows
+  std::uint64_t filetime;  // of the last modification, 0 if there is none
+};
+
+// Receives extracted entries, one at a time. A sink is used by one thread
+// only, any call returning false stops extraction.
+struct IEntrySink {
+  virtual ~IEntrySink() = default;
+  virtual bool OnEntryBegin(const EntryInfo& entry) = 0;
+  // Sets *view to a buffer the entry of known size is decoded into instead
+  // of being passed to OnData, nullptr if the sink takes the data in pieces.
+  // The view stays valid until OnEntryEnd.
+  virtual bool Map(PBYTE* view) = 0;
+  virtual bool OnData(const BYTE* ptr, std::size_t size) = 0;
+  // Ends the entry, its sizes and crc are known and the crc is verified.
+  virtual bool OnEntryEnd(const EntryInfo& entry) = 0;
+  // Waits until the entries ended so far are stored, false if any failed.
+  virtual bool Flush() = 0;
+};
+
+// Creates a sink for each thread extracting an archive, from any thread.
+struct IEntrySinkFactory {
+  virtual ~IEntrySinkFactory() = default;
+  virtual std::unique_ptr<IEntrySink> Create() = 0;
+};
+
+// Writes entries to files under their paths, through CreateFileSink().
+class FileEntrySinkFactory : public IEntrySinkFactory {
+ public:
+  FileEntrySinkFactory() = default;
+  FileEntrySinkFactory(const FileEntrySinkFactory& other) = delete;
+  FileEntrySinkFactory(FileEntrySinkFactory&& other) = delete;
+  FileEntrySinkFactory& operator=(const FileEntrySinkFactory& other) = delete;
+  FileEntrySinkFactory& operator=(FileEntrySinkFactory&& other) = delete;
+
+  // times gives files the modification time of their entries. buffers,
+  // preallocate, directories, pool and stats as in CreateFileSink(), files at
+  // least map_size large are mapped and decoded in place, 0 never maps.
+  void Initialize(bool overwrite, bool times, unsigned buffers,
+                  bool preallocate, std::uint64_t map_size,
+                  DirectoryCache* directories, FilePool* pool,
+                  Stats* stats = nullptr);
+  std::unique_ptr<IEntrySink> Create() override;
+
+ private:
+  bool overwrite_{false};
+  bool times_{false};
+  unsigned buffers_{0};
+  bool preallocate_{false};
+  std::uint64_t map_size_{0};
+  DirectoryCache* directories_{nullptr};
+  FilePool* pool_{nullptr};
+  Stats* stats_{nullptr};
+};
+
+// Keeps entries in memory, their data in an arena shared by the sinks.
+class MemoryEntrySinkFactory : public IEntrySinkFactory {
+ public:
+  struct Entry {
+    std::string name;
+    bool directory;
+    const BYTE* data;  // in the arena, nullptr if the entry is empty
+    std::size_t size;
+    std::uint32_t crc32;
+    std::uint64_t filetime;
+  };
+
+  MemoryEntrySinkFactory() = default;
+  MemoryEntrySinkFactory(const MemoryEntrySinkFactory& other) = delete;
+  MemoryEntrySinkFactory(MemoryEntrySinkFactory&& other) = delete;
+  MemoryEntrySinkFactory& operator=(const MemoryEntrySinkFactory& other) =
+      delete;
+  MemoryEntrySinkFactory& operator=(MemoryEntrySinkFactory&& other) = delete;
+
+  std::unique_ptr<IEntrySink> Create() override;
+  // Entries in the order they ended, complete once extraction is.
+  const std::vector<Entry>& entries() const { return entries_; }
+  // Used by the sinks, safe to call from several threads.
+  PBYTE Allocate(std::size_t size);
+  void Add(Entry&& entry);
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<BYTE[]>> blocks_;
+  PBYTE next_{nullptr};  // free space of the last small block
+  std::size_t available_{0};
+  std::vector<Entry> entries_;
+};
+
+// Takes entries and drops them, for checking an archive without writing it.
+class DiscardEntrySinkFactory : public IEntrySinkFactory {
+ public:
+  std::unique_ptr<IEntrySink> Create() override;
+};
\ No newline at end of file
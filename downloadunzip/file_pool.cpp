@@ -0,0 +1,96 @@
+#include "stdafx.h"
+
+#include "file_pool.h"
+
+#include "file_sink.h"
+#include "stats.h"
+
+namespace {
+
+constexpr std::size_t kMaxQueuedSize = 0x4000000;  // 64 MiB
+
+}  // namespace
+
+FilePool::~FilePool() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  for (auto& worker : workers_) {
+    worker->queued_cv.notify_one();
+    worker->thread.join();
+  }
+}
+
+void FilePool::Initialize(unsigned threads, DirectoryCache* directories,
+                          Stats* stats) {
+  assert(workers_.empty());
+  directories_ = directories;
+  stats_ = stats;
+  for (auto i = 0u; i < threads; ++i)
+    workers_.push_back(std::make_unique<Worker>());
+  for (auto& worker : workers_)
+    worker->thread = std::thread{&FilePool::Run, this, worker.get()};
+}
+
+bool FilePool::Submit(Batch* batch, std::string&& path,
+                      std::size_t existing_size, bool overwrite,
+                      std::vector<BYTE>&& data, std::uint64_t filetime) {
+  assert(!workers_.empty());
+  auto end = path.find_last_of("/\\");
+  auto directory = path.substr(0, end == std::string::npos ? 0 : end);
+  auto hash = std::hash<std::string>{}(directory);
+  auto& worker = workers_[hash % workers_.size()];
+  auto size = data.size();
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    // always accept a file into an empty pool, otherwise stay under the limit
+    done_cv_.wait(lock, [this, size] {
+      return !queued_size_ || queued_size_ + size <= kMaxQueuedSize;
+    });
+    if (batch->failed) return false;
+    queued_size_ += size;
+    ++batch->pending;
+    worker->jobs.push_back(Job{batch, std::move(path), existing_size,
+                               overwrite, std::move(data), filetime});
+  }
+  worker->queued_cv.notify_one();
+  return true;
+}
+
+bool FilePool::Wait(Batch* batch) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  done_cv_.wait(lock, [batch] { return !batch->pending; });
+  return !batch->failed;
+}
+
+void FilePool::Run(Worker* worker) {
+  FileSink sink;
+  sink.Initialize(false, directories_);
+  std::unique_lock<std::mutex> lock{mutex_};
+  for (;;) {
+    worker->queued_cv.wait(
+        lock, [this, worker] { return stop_ || !worker->jobs.empty(); });
+    if (worker->jobs.empty()) return;
+    auto job = std::move(worker->jobs.front());
+    worker->jobs.pop_front();
+    auto failed = job.batch->failed;
+    lock.unlock();
+    // files of a failed batch are dropped, its extraction is about to stop
+    auto size = job.data.size();
+    auto ok = failed;
+    if (!failed) {
+      StageTimer timer{stats_, Stats::Stage::kDisk};
+      ok = sink.Create(job.path.c_str(), job.existing_size, job.overwrite,
+                       size) &&
+           (!size || sink.Write(job.data.data(), size)) &&
+           sink.Close(job.filetime);
+      timer.Add(size);
+    }
+    lock.lock();
+    if (!ok) job.batch->failed = true;
+    queued_size_ -= size;
+    --job.batch->pending;
+    done_cv_.notify_all();
+  }
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+class DirectoryCache;
+class Stats;
+
+// Creates, writes and closes whole small files on a pool of threads, so that
+// extraction doesn't wait for per-file system calls. Files in one directory
+// go to the same thread, which creates them in the order they came, so that
+// threads don't contend for a directory and its index stays warm.
+class FilePool {
+ public:
+  // Files submitted by one sink, guarded by the pool.
+  struct Batch {
+    unsigned pending;
+    bool failed;
+  };
+
+  FilePool() = default;
+  ~FilePool();
+  FilePool(const FilePool& other) = delete;
+  FilePool(FilePool&& other) = delete;
+  FilePool& operator=(const FilePool& other) = delete;
+  FilePool& operator=(FilePool&& other) = delete;
+
+  // writing files is counted to stats unless it's nullptr
+  void Initialize(unsigned threads, DirectoryCache* directories,
+                  Stats* stats = nullptr);
+  // Queues a file holding data, waits while too much data is queued. False if
+  // a file of the batch failed.
+  bool Submit(Batch* batch, std::string&& path, std::size_t existing_size,
+              bool overwrite, std::vector<BYTE>&& data,
+              std::uint64_t filetime);
+  // Waits until the files of the batch are on disk, false if any failed.
+  bool Wait(Batch* batch);
+
+ private:
+  struct Job {
+    Batch* batch;
+    std::string path;
+    std::size_t existing_size;
+    bool overwrite;
+    std::vector<BYTE> data;
+    std::uint64_t filetime;
+  };
+  struct Worker {
+    std::thread thread;
+    std::condition_variable queued_cv;
+    std::deque<Job> jobs;
+  };
+
+  void Run(Worker* worker);
+
+  DirectoryCache* directories_{nullptr};
+  Stats* stats_{nullptr};
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
+  std::size_t queued_size_{0};
+  bool stop_{false};
+};
\ No newline at end of file
@@ -0,0 +1,356 @@
+#include "stdafx.h"
+
+#include "file_sink.h"
+
+#include "directory_cache.h"
+#include "stats.h"
+
+namespace {
+
+constexpr std::size_t kBufferSize = 0x100000;     // 1 MiB
+constexpr std::size_t kSmallFileSize = 0x100000;  // 1 MiB
+constexpr std::size_t kMaxWriteSize = 0x4000000;  // 64 MiB
+
+HANDLE CreateFileForWriting(PCSTR path, bool overwrite) {
+  DWORD creation_disposition = overwrite ? CREATE_ALWAYS : CREATE_NEW;
+  // read access lets the file be mapped for writing
+  return ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                       creation_disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+}  // namespace
+
+std::unique_ptr<IFileSink> CreateFileSink(unsigned buffers, bool preallocate,
+                                          DirectoryCache* directories,
+                                          FilePool* pool, Stats* stats) {
+  std::unique_ptr<IFileSink> sink;
+  if (buffers) {
+    auto queued_sink = std::make_unique<QueuedFileSink>();
+    queued_sink->Initialize(buffers, preallocate, directories, stats);
+    sink = std::move(queued_sink);
+  } else {
+    auto file_sink = std::make_unique<FileSink>();
+    file_sink->Initialize(preallocate, directories);
+    sink = std::move(file_sink);
+  }
+  if (!pool) return sink;
+  auto pooled_sink = std::make_unique<PooledFileSink>();
+  pooled_sink->Initialize(pool, std::move(sink));
+  return pooled_sink;
+}
+
+bool FileSink::Create(PCSTR path, std::size_t existing_size, bool overwrite,
+                      std::uint64_t size) {
+  view_.reset();
+  mapping_.reset();
+  file_.reset();
+  path_ = path;
+  size_ = size;
+  if (directories_ && !directories_->Create(path, existing_size)) return false;
+  auto file = CreateFileForWriting(path, overwrite);
+  if (file != INVALID_HANDLE_VALUE) {
+    file_.reset(file);
+    Preallocate();
+    return true;
+  }
+  auto error = GetLastError();
+  if (directories_ || error != ERROR_PATH_NOT_FOUND) {
+    std::cerr << "error creating file " << path << " (code " << error << ')'
+              << std::endl;
+    return false;
+  }
+  // create directory
+  auto directory = &path_[0];
+  for (auto i = existing_size; directory[i]; ++i) {
+    for (; directory[i] && directory[i] != '/' && directory[i] != '\\'; ++i)
+      ;
+    if (!directory[i]) break;
+    auto ch = directory[i];
+    directory[i] = 0;
+    auto succeeded = CreateDirectory(directory, NULL);
+    error = GetLastError();
+    directory[i] = ch;
+    if (!succeeded && error != ERROR_ALREADY_EXISTS) {
+      std::cerr << "error creating directory " << directory << " (code "
+                << error << ')' << std::endl;
+      return false;
+    }
+  }
+  file = CreateFileForWriting(path, overwrite);
+  if (file != INVALID_HANDLE_VALUE) {
+    file_.reset(file);
+    Preallocate();
+    return true;
+  }
+  error = GetLastError();
+  std::cerr << "error creating file " << path << " (code " << error << ')'
+            << std::endl;
+  return false;
+}
+
+bool FileSink::Write(const BYTE* ptr, std::size_t size) {
+  assert(file_);
+  // a stored entry may come in one span of 4 GiB or more
+  while (size) {
+    DWORD written = 0;
+    auto chunk = static_cast<DWORD>((std::min)(size, kMaxWriteSize));
+    if (!WriteFile(file_.get(), ptr, chunk, &written, NULL)) break;
+    if (written != chunk) {
+      std::cerr << "error writing file " << path_ << " (wrote " << written
+                << " of " << chunk << " bytes)" << std::endl;
+      return false;
+    }
+    ptr += written;
+    size -= written;
+  }
+  if (!size) return true;
+  auto error = GetLastError();
+  std::cerr << "error writing file " << path_ << " (code " << error << ')'
+            << std::endl;
+  return false;
+}
+
+PBYTE FileSink::Map() {
+  assert(file_ && !view_ && size_ && size_ != kUnknownSize);
+  if (SIZE_MAX < size_) {
+    std::cerr << "error mapping file " << path_ << " (too large for a view)"
+              << std::endl;
+    return nullptr;
+  }
+  // the mapping extends the file, preallocated or not
+  auto mapping = CreateFileMappingA(file_.get(), NULL, PAGE_READWRITE,
+                                    static_cast<DWORD>(size_ >> 32),
+                                    static_cast<DWORD>(size_), NULL);
+  if (mapping) {
+    mapping_.reset(mapping);
+    auto view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0,
+                              static_cast<SIZE_T>(size_));
+    if (view) {
+      view_.reset(view);
+      return static_cast<PBYTE>(view);
+    }
+  }
+  auto error = GetLastError();
+  std::cerr << "error mapping file " << path_ << " (code " << error << ')'
+            << std::endl;
+  return nullptr;
+}
+
+bool FileSink::Close(std::uint64_t filetime) {
+  assert(file_);
+  // dirty pages are written back by the system after the view is gone
+  view_.reset();
+  mapping_.reset();
+  auto file = std::move(file_);
+  if (!filetime) return true;
+  FILETIME last_write_time{static_cast<DWORD>(filetime),
+                           static_cast<DWORD>(filetime >> 32)};
+  if (SetFileTime(file.get(), NULL, NULL, &last_write_time)) return true;
+  auto error = GetLastError();
+  std::cerr << "error setting time of file " << path_ << " (code " << error
+            << ')' << std::endl;
+  return false;
+}
+
+void FileSink::Preallocate() {
+  if (!preallocate_ || !size_ || size_ == kUnknownSize) return;
+  // reserves clusters only, the end of file still follows the writes
+  FILE_ALLOCATION_INFO info{};
+  info.AllocationSize.QuadPart = static_cast<LONGLONG>(size_);
+  // not every file system takes the hint, the file is written either way
+  SetFileInformationByHandle(file_.get(), FileAllocationInfo, &info,
+                             sizeof(info));
+}
+
+QueuedFileSink::~QueuedFileSink() {
+  if (!thread_.joinable()) return;
+  // queued files are completed, the last one might stay partial
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  queued_cv_.notify_one();
+  thread_.join();
+}
+
+void QueuedFileSink::Initialize(unsigned buffers, bool preallocate,
+                                DirectoryCache* directories, Stats* stats) {
+  assert(!thread_.joinable());
+  stats_ = stats;
+  sink_.Initialize(preallocate, directories);
+  for (auto i = 0u; i < buffers; ++i) {
+    buffers_.push_back(std::make_unique<Buffer>());
+    buffers_.back()->data.reset(new BYTE[kBufferSize]);
+    free_.push_back(buffers_.back().get());
+  }
+  thread_ = std::thread{&QueuedFileSink::Run, this};
+}
+
+bool QueuedFileSink::Create(PCSTR path, std::size_t existing_size,
+                            bool overwrite, std::uint64_t size) {
+  Queue(Operation{Command::kCreate, path, existing_size, overwrite, size});
+  return !failed_;
+}
+
+bool QueuedFileSink::Write(const BYTE* ptr, std::size_t size) {
+  while (size) {
+    if (!buffer_) {
+      std::unique_lock<std::mutex> lock{mutex_};
+      done_cv_.wait(lock, [this] { return !free_.empty(); });
+      buffer_ = free_.back();
+      free_.pop_back();
+      buffer_->size = 0;
+      buffer_->refs = 1;
+      begin_ = 0;
+    }
+    auto copy_size = (std::min)(size, kBufferSize - buffer_->size);
+    std::memcpy(buffer_->data.get() + buffer_->size, ptr, copy_size);
+    buffer_->size += copy_size;
+    ptr += copy_size;
+    size -= copy_size;
+    if (buffer_->size < kBufferSize) break;
+    // full buffers go out whole
+    QueueWrite();
+    Release(buffer_);
+    buffer_ = nullptr;
+  }
+  return !failed_;
+}
+
+PBYTE QueuedFileSink::Map() {
+  // mapped files are written by the caller, once the I/O thread has created
+  // the file it stays idle until the close is queued
+  if (!Flush()) return nullptr;
+  return sink_.Map();
+}
+
+bool QueuedFileSink::Close(std::uint64_t filetime) {
+  // the rest of the buffer is left to the next files
+  QueueWrite();
+  Operation operation{Command::kClose};
+  operation.filetime = filetime;
+  Queue(std::move(operation));
+  return !failed_;
+}
+
+bool QueuedFileSink::Flush() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  done_cv_.wait(lock, [this] { return operations_.empty() && !busy_; });
+  return !failed_;
+}
+
+void QueuedFileSink::Queue(Operation&& operation) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    operations_.push_back(std::move(operation));
+  }
+  queued_cv_.notify_one();
+}
+
+void QueuedFileSink::QueueWrite() {
+  if (!buffer_ || begin_ == buffer_->size) return;
+  Operation operation{Command::kWrite};
+  operation.buffer = buffer_;
+  operation.begin = begin_;
+  operation.end = buffer_->size;
+  begin_ = buffer_->size;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    ++buffer_->refs;
+    operations_.push_back(std::move(operation));
+  }
+  queued_cv_.notify_one();
+}
+
+void QueuedFileSink::Release(Buffer* buffer) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (--buffer->refs) return;
+  free_.push_back(buffer);
+  done_cv_.notify_all();
+}
+
+void QueuedFileSink::Run() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  for (;;) {
+    queued_cv_.wait(lock, [this] { return stop_ || !operations_.empty(); });
+    if (operations_.empty()) return;
+    auto operation = std::move(operations_.front());
+    operations_.pop_front();
+    busy_ = true;
+    lock.unlock();
+    // after a failure files are only closed, extraction is about to stop
+    auto ok = true;
+    {
+      StageTimer timer{stats_, Stats::Stage::kDisk};
+      switch (operation.command) {
+        case Command::kCreate:
+          ok = failed_ || sink_.Create(operation.path.c_str(),
+                                       operation.existing_size,
+                                       operation.overwrite, operation.size);
+          break;
+        case Command::kWrite:
+          ok = failed_ ||
+               sink_.Write(operation.buffer->data.get() + operation.begin,
+                           operation.end - operation.begin);
+          timer.Add(operation.end - operation.begin);
+          break;
+        case Command::kClose:
+          ok = failed_ || sink_.Close(operation.filetime);
+          break;
+      }
+    }
+    lock.lock();
+    if (!ok) failed_ = true;
+    if (operation.buffer && !--operation.buffer->refs)
+      free_.push_back(operation.buffer);
+    busy_ = false;
+    done_cv_.notify_all();
+  }
+}
+
+PooledFileSink::~PooledFileSink() {
+  // the pool holds on to the batch until its files are done
+  if (pool_) pool_->Wait(&batch_);
+}
+
+void PooledFileSink::Initialize(FilePool* pool,
+                                std::unique_ptr<IFileSink>&& sink) {
+  pool_ = pool;
+  sink_ = std::move(sink);
+}
+
+bool PooledFileSink::Create(PCSTR path, std::size_t existing_size,
+                            bool overwrite, std::uint64_t size) {
+  pooled_ = size <= kSmallFileSize;
+  if (!pooled_) return sink_->Create(path, existing_size, overwrite, size);
+  path_ = path;
+  existing_size_ = existing_size;
+  overwrite_ = overwrite;
+  size_ = static_cast<std::size_t>(size);
+  data_.clear();
+  data_.reserve(size_);
+  return true;
+}
+
+bool PooledFileSink::Write(const BYTE* ptr, std::size_t size) {
+  if (!pooled_) return sink_->Write(ptr, size);
+  data_.insert(data_.end(), ptr, ptr + size);
+  return true;
+}
+
+PBYTE PooledFileSink::Map() {
+  if (!pooled_) return sink_->Map();
+  data_.resize(size_);
+  return data_.data();
+}
+
+bool PooledFileSink::Close(std::uint64_t filetime) {
+  if (!pooled_) return sink_->Close(filetime);
+  return pool_->Submit(&batch_, std::move(path_), existing_size_, overwrite_,
+                       std::move(data_), filetime);
+}
+
+bool PooledFileSink::Flush() {
+  auto ok = pool_->Wait(&batch_);
+  return sink_->Flush() && ok;
+}
\ No newline at end of file
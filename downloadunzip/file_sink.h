@@ -0,0 +1,162 @@
+#pragma once
+#include "file_pool.h"
+
+class DirectoryCache;
+class Stats;
+
+// Where extracted files go, one file at a time.
+struct IFileSink {
+  static constexpr std::uint64_t kUnknownSize = UINT64_MAX;
+
+  virtual ~IFileSink() = default;
+  // Creates the file and the directories up to it, the first existing_size
+  // characters of path name a directory that exists already. size is what
+  // the file is going to hold, kUnknownSize if it isn't known yet.
+  virtual bool Create(PCSTR path, std::size_t existing_size, bool overwrite,
+                      std::uint64_t size) = 0;
+  virtual bool Write(const BYTE* ptr, std::size_t size) = 0;
+  // Extends the file to its known size and maps it for writing instead,
+  // nullptr on error. The view stays valid until Close.
+  virtual PBYTE Map() = 0;
+  // Stamps the file with filetime, unless it's 0, and closes it.
+  virtual bool Close(std::uint64_t filetime) = 0;
+  // Waits until everything passed in is on disk, false if anything failed.
+  virtual bool Flush() = 0;
+};
+
+// buffers is the number of write buffers queued to an I/O thread, 0 writes
+// synchronously. preallocate reserves disk space for the whole file on
+// creation, so appends don't fragment it. directories and pool may be
+// nullptr, small files go to the pool if there is one. Writes on the I/O
+// thread are counted to stats unless it's nullptr.
+std::unique_ptr<IFileSink> CreateFileSink(unsigned buffers, bool preallocate,
+                                          DirectoryCache* directories,
+                                          FilePool* pool,
+                                          Stats* stats = nullptr);
+
+class FileSink : public IFileSink {
+ public:
+  FileSink() = default;
+  FileSink(const FileSink& other) = delete;
+  FileSink(FileSink&& other) = delete;
+  FileSink& operator=(const FileSink& other) = delete;
+  FileSink& operator=(FileSink&& other) = delete;
+
+  // directories may be nullptr, then missing ones are found by failing to
+  // create the file
+  void Initialize(bool preallocate, DirectoryCache* directories) {
+    preallocate_ = preallocate;
+    directories_ = directories;
+  }
+  bool Create(PCSTR path, std::size_t existing_size, bool overwrite,
+              std::uint64_t size) override;
+  bool Write(const BYTE* ptr, std::size_t size) override;
+  PBYTE Map() override;
+  bool Close(std::uint64_t filetime) override;
+  bool Flush() override { return true; }
+
+ private:
+  void Preallocate();
+
+  bool preallocate_{false};
+  DirectoryCache* directories_{nullptr};
+  std::string path_;
+  std::uint64_t size_{0};
+  std::unique_ptr<void, decltype(&CloseHandle)> file_{nullptr, CloseHandle};
+  std::unique_ptr<void, decltype(&CloseHandle)> mapping_{nullptr, CloseHandle};
+  std::unique_ptr<void, decltype(&UnmapViewOfFile)> view_{nullptr,
+                                                          UnmapViewOfFile};
+};
+
+// Creates, writes and closes files on a thread of its own, so extraction
+// goes on while the disk catches up. Small files share buffers, a buffer is
+// reused once all of its data is written. Writes go out one at a time, the
+// system completes writes extending a file synchronously even if overlapped.
+class QueuedFileSink : public IFileSink {
+ public:
+  QueuedFileSink() = default;
+  ~QueuedFileSink();
+  QueuedFileSink(const QueuedFileSink& other) = delete;
+  QueuedFileSink(QueuedFileSink&& other) = delete;
+  QueuedFileSink& operator=(const QueuedFileSink& other) = delete;
+  QueuedFileSink& operator=(QueuedFileSink&& other) = delete;
+
+  void Initialize(unsigned buffers, bool preallocate,
+                  DirectoryCache* directories, Stats* stats = nullptr);
+  bool Create(PCSTR path, std::size_t existing_size, bool overwrite,
+              std::uint64_t size) override;
+  bool Write(const BYTE* ptr, std::size_t size) override;
+  PBYTE Map() override;
+  bool Close(std::uint64_t filetime) override;
+  bool Flush() override;
+
+ private:
+  struct Buffer {
+    std::unique_ptr<BYTE[]> data;
+    std::size_t size;
+    unsigned refs;  // the filling side and queued writes
+  };
+  enum class Command { kCreate, kWrite, kClose };
+  struct Operation {
+    Command command;
+    std::string path;
+    std::size_t existing_size;
+    bool overwrite;
+    std::uint64_t size;
+    Buffer* buffer;
+    std::size_t begin;
+    std::size_t end;
+    std::uint64_t filetime;
+  };
+
+  void Queue(Operation&& operation);
+  void QueueWrite();
+  void Release(Buffer* buffer);
+  void Run();
+
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+  Buffer* buffer_{nullptr};  // being filled
+  std::size_t begin_{0};     // of the data not queued yet
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Operation> operations_;
+  std::vector<Buffer*> free_;
+  bool busy_{false};
+  bool stop_{false};
+  std::atomic<bool> failed_{false};
+  Stats* stats_{nullptr};
+  FileSink sink_;  // I/O thread only, unless it's idle
+};
+
+// Hands small files to a FilePool whole, larger ones go to a sink of their
+// own.
+class PooledFileSink : public IFileSink {
+ public:
+  PooledFileSink() = default;
+  ~PooledFileSink();
+  PooledFileSink(const PooledFileSink& other) = delete;
+  PooledFileSink(PooledFileSink&& other) = delete;
+  PooledFileSink& operator=(const PooledFileSink& other) = delete;
+  PooledFileSink& operator=(PooledFileSink&& other) = delete;
+
+  void Initialize(FilePool* pool, std::unique_ptr<IFileSink>&& sink);
+  bool Create(PCSTR path, std::size_t existing_size, bool overwrite,
+              std::uint64_t size) override;
+  bool Write(const BYTE* ptr, std::size_t size) override;
+  PBYTE Map() override;
+  bool Close(std::uint64_t filetime) override;
+  bool Flush() override;
+
+ private:
+  FilePool* pool_{nullptr};
+  FilePool::Batch batch_{};
+  std::unique_ptr<IFileSink> sink_;  // for large files
+  bool pooled_{false};               // the file being written is
+  std::string path_;
+  std::size_t existing_size_{0};
+  bool overwrite_{false};
+  std::size_t size_{0};
+  std::vector<BYTE> data_;
+};
\ No newline at end of file
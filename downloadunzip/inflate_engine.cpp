@@ -0,0 +1,57 @@
+#include "stdafx.h"
+
+#include "inflate_engine.h"
+
+bool ParseInflateBackend(PCSTR name, InflateBackend* backend) {
+  if (strcmp(name, "stream") == 0)
+    *backend = InflateBackend::kStream;
+  else if (strcmp(name, "buffer") == 0)
+    *backend = InflateBackend::kBuffer;
+  else
+    return false;
+  return true;
+}
+
+std::unique_ptr<IInflateEngine> CreateInflateEngine(InflateBackend backend) {
+  switch (backend) {
+    case InflateBackend::kBuffer:
+      return std::make_unique<ZlibInflateEngine>();
+    default:
+      return nullptr;
+  }
+}
+
+ZlibInflateEngine::~ZlibInflateEngine() {
+  if (initialized_) inflateEnd(&strm_);
+}
+
+bool ZlibInflateEngine::Inflate(PBYTE in, std::size_t in_size, PBYTE out,
+                                std::size_t out_size) {
+  assert(out_size);  // zlib rejects a null output buffer
+  auto res = initialized_ ? inflateReset(&strm_)
+                          : inflateInit2(&strm_, -MAX_WBITS);
+  if (res != Z_OK) {
+    std::cerr << "error initializing zlib (code " << res << ')' << std::endl;
+    return false;
+  }
+  initialized_ = true;
+  strm_.next_in = in;
+  strm_.avail_in = static_cast<uInt>(in_size);
+  strm_.next_out = out;
+  strm_.avail_out = static_cast<uInt>(out_size);
+  // with all of the output at hand inflate() stays in its fast loop and
+  // never flushes the window
+  res = inflate(&strm_, Z_FINISH);
+  if (res == Z_STREAM_END && !strm_.avail_out) return true;
+  switch (res) {
+    case Z_NEED_DICT:
+      res = Z_DATA_ERROR;  // and fall through
+    case Z_DATA_ERROR:
+    case Z_MEM_ERROR:
+      std::cerr << "zlib error (code " << res << ')' << std::endl;
+      break;
+    default:  // sizes don't match the deflate stream
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+  }
+  return false;
+}
\ No newline at end of file
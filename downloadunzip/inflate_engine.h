@@ -0,0 +1,37 @@
+#pragma once
+
+enum class InflateBackend {
+  kStream,  // zlib inflate() through a 16 KiB window, entries of any size
+  kBuffer,  // whole entries up to a threshold inflated with one call
+};
+
+bool ParseInflateBackend(PCSTR name, InflateBackend* backend);
+
+// Inflates raw deflate data held in memory in one call.
+struct IInflateEngine {
+  virtual ~IInflateEngine() = default;
+  // Fails unless the data inflates to exactly out_size bytes.
+  virtual bool Inflate(PBYTE in, std::size_t in_size, PBYTE out,
+                       std::size_t out_size) = 0;
+};
+
+// nullptr for backends that stream
+std::unique_ptr<IInflateEngine> CreateInflateEngine(InflateBackend backend);
+
+// Keeps the zlib state between entries, so only the first one allocates it.
+class ZlibInflateEngine : public IInflateEngine {
+ public:
+  ZlibInflateEngine() = default;
+  ~ZlibInflateEngine();
+  ZlibInflateEngine(const ZlibInflateEngine& other) = delete;
+  ZlibInflateEngine(ZlibInflateEngine&& other) = delete;
+  ZlibInflateEngine& operator=(const ZlibInflateEngine& other) = delete;
+  ZlibInflateEngine& operator=(ZlibInflateEngine&& other) = delete;
+
+  bool Inflate(PBYTE in, std::size_t in_size, PBYTE out,
+               std::size_t out_size) override;
+
+ private:
+  z_stream strm_{};
+  bool initialized_{false};
+};
\ No newline at end of file
@@ -1,18 +1,36 @@
 #include "stdafx.h"
 
+#include "batch.h"
+#include "checkpoint.h"
 #include "cmdline.h"
 #include "curl_bytestream_adapter.h"
 #include "curl_globals.h"
-#include "sha256.h"
+#include "curl_range_source.h"
+#include "curl_share.h"
+#include "digest_list.h"
+#include "directory_cache.h"
+#include "entry_sink.h"
+#include "file_pool.h"
+#include "mapped_file_source.h"
+#include "pipe_bytestream.h"
+#include "sha256_worker.h"
+#include "stats.h"
+#include "tar_sink.h"
+#include "trace.h"
+#include "update_index.h"
+
+constexpr char kUpdateIndexPath[] = ".downloadunzip-index";
 
 ProgramOptions Options;
 char ContentDisposition[MAX_PATH];
 bool ContentDispositionFound;
 HANDLE ZipFile;
 DWORD ZipFileError;
-SHA256 Sha256;
+SHA256Worker Sha256;
 BYTE Sha256Bytes[32];
-bool Sha256Error;
+std::uint64_t StreamOffset;  // the download resumes at
+Stats RunStats;
+Trace RunTrace;
 
 std::size_t CURLHeaderFunction(PSTR ptr, std::size_t size, std::size_t nitems,
                                PVOID userdata) {
@@ -114,12 +132,94 @@ std::size_t WriteZipFile(PSTR ptr, std::size_t dummy, std::size_t size,
   return ret;
 }
 
+// the adapter hashes downloaded data itself
+std::size_t CURLSaveFunction(PSTR ptr, std::size_t size, std::size_t nmemb,
+                             PVOID userdata) {
+  size *= nmemb;
+  if (Options.save && !ZipFileError) WriteZipFile(ptr, 1, size, userdata);
+  return size;
+}
+
 std::size_t CURLWriteFunction(PSTR ptr, std::size_t size, std::size_t nmemb,
                               PVOID userdata) {
-  if (Options.save && !ZipFileError) WriteZipFile(ptr, size, nmemb, userdata);
-  if (Options.sha256 && !Sha256Error)
-    Sha256Error = !Sha256.Hash(reinterpret_cast<PBYTE>(ptr), size);
-  return size * nmemb;
+  size = CURLSaveFunction(ptr, size, nmemb, userdata);
+  if (Options.sha256) Sha256.Hash(ptr, size);
+  return size;
+}
+
+std::size_t CURLResumeHeaderFunction(PSTR ptr, std::size_t size,
+                                     std::size_t nitems, PVOID userdata) {
+  size *= nitems;
+  // a server that ignores the range sends the archive from the start
+  constexpr char kHttp[] = "HTTP/";
+  constexpr auto kHttpLen = sizeof(kHttp) - 1;
+  if (size <= kHttpLen || strncmp(ptr, kHttp, kHttpLen)) return size;
+  auto space = reinterpret_cast<PCSTR>(memchr(ptr, ' ', size));
+  if (!space || strtol(space + 1, NULL, 10) != 200) return size;
+  std::cerr << "server doesn't support resuming the download" << std::endl;
+  return 0;
+}
+
+class CheckpointProgress : public IUnzipProgress {
+ public:
+  explicit CheckpointProgress(Checkpoint* checkpoint)
+      : checkpoint_{checkpoint} {}
+
+  void Extracted(std::uint64_t offset, std::uint64_t entries) {
+    CheckpointState state{offset, entries, {}};
+    // the data was queued for hashing before it could be extracted
+    if (Options.sha256) state.sha256 = Sha256.State(offset);
+    checkpoint_->Save(state);
+  }
+
+ private:
+  Checkpoint* checkpoint_;
+};
+
+bool Resume(const CheckpointState& state, UnzipOptions* options) {
+  if (Options.sha256 && state.offset) {
+    if (state.sha256.size < state.offset) {
+      std::cerr << "checkpoint has no SHA-256 state to resume from"
+                << std::endl;
+      return false;
+    }
+  }
+  StreamOffset = state.offset;
+  options->offset = state.offset;
+  options->entries = state.entries;
+  if (Options.verbose)
+    std::cerr << "resuming at offset " << state.offset << " after "
+              << state.entries << " entries" << std::endl;
+  return true;
+}
+
+bool VerifySha256() {
+  if (!Sha256.Finish(Sha256Bytes)) return false;
+  if (std::equal(std::cbegin(Sha256Bytes), std::cend(Sha256Bytes),
+                 std::cbegin(Options.sha256_bytes)))
+    return true;
+  std::cerr << "SHA-256 hash doesn't match" << std::endl;
+  return false;
+}
+
+// Unzips --input, the archive is hashed the way a download is.
+bool UnzipInput(UnzipOptions* options) {
+  auto ok = false;
+  if (strcmp(Options.input, "-") == 0) {
+    PipeBytestream pipe{CURLWriteFunction};
+    if (!pipe.Initialize()) return false;
+    ok = Unzip(&pipe, options);
+    if (Options.sha256) pipe.RunToTheEnd();
+  } else {
+    MappedFileSource file{CURLWriteFunction};
+    if (!file.Initialize(Options.input)) return false;
+    if (Options.ranges)
+      return Unzip(static_cast<IRangeSource*>(&file), options);
+    ok = Unzip(static_cast<IBytestream*>(&file), options);
+    if (Options.sha256) file.RunToTheEnd();
+  }
+  if (Options.sha256 && !VerifySha256()) ok = false;
+  return ok;
 }
 
 std::size_t CURLDiscardFunction(PSTR ptr, std::size_t size, std::size_t nmemb,
@@ -127,14 +227,17 @@ std::size_t CURLDiscardFunction(PSTR ptr, std::size_t size, std::size_t nmemb,
   return size * nmemb;
 }
 
-int main(int argc, char *argv[]) {
+int Run(int argc, char *argv[]) {
   if (!ParseCommandLine(argc, argv, &Options)) {
     PrintHelp();
     return 1;
   }
   try {
+    std::vector<BatchItem> batch_items;
+    if (Options.batch && !ReadManifest(Options.batch, &batch_items)) return 1;
     CURLGlobals curl_globals;
     if (!curl_globals.Initialize()) return 1;
+    CURLShare share;  // outlives the handles attached to it
     std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl{curl_easy_init(),
                                                              curl_easy_cleanup};
     if (!curl) {
@@ -142,41 +245,169 @@ int main(int argc, char *argv[]) {
       return 1;
     }
     if (Options.verbose) curl_easy_setopt(curl.get(), CURLOPT_VERBOSE, 1);
+    auto stats = Options.stats ? &RunStats : nullptr;
+    auto trace = Options.trace ? &RunTrace : nullptr;
+    if (Options.batch) {
+      // the login cookies end up in the share
+      if (!share.Initialize()) return 1;
+      share.Attach(curl.get());
+    }
     if (Options.login_url) {
       curl_easy_setopt(curl.get(), CURLOPT_URL, Options.login_url);
       curl_easy_setopt(curl.get(), CURLOPT_POSTFIELDS, Options.login_post_data);
       curl_easy_setopt(curl.get(), CURLOPT_COOKIEFILE, "");
       curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, CURLDiscardFunction);
-      auto res = curl_easy_perform(curl.get());
+      auto res = CURLE_OK;
+      {
+        StageTimer timer{stats, Stats::Stage::kNetwork};
+        TraceSpan span{trace, "login"};
+        res = curl_easy_perform(curl.get());
+      }
       if (res != CURLE_OK) return 1;
     }
-    CURLBytestreamAdapter curl_bytestream_adapter{CURLWriteFunction};
-    if (!curl_bytestream_adapter.Initialize(curl.get())) return 1;
     curl_easy_setopt(curl.get(), CURLOPT_HTTPGET, 1L);
     curl_easy_setopt(curl.get(), CURLOPT_URL, Options.url);
     curl_easy_setopt(curl.get(), CURLOPT_FOLLOWLOCATION, 1L);
+    UnzipOptions unzip_options{};
+    unzip_options.threads = Options.threads;
+    unzip_options.inflate = Options.inflate;
+    unzip_options.inflate_threshold = Options.inflate_threshold;
+    unzip_options.stats = stats;
+    unzip_options.trace = trace;
+    if (!Options.filter.empty()) unzip_options.filter = &Options.filter;
+    UpdateIndex update_index;
+    if (Options.update) {
+      if (!update_index.Initialize(kUpdateIndexPath)) return 1;
+      unzip_options.update = &update_index;
+    }
+    DigestList digests;
+    if (Options.entry_sha256) {
+      digests.Initialize(Options.entry_sha256);
+      unzip_options.digests = &digests;
+    }
+    Checkpoint checkpoint;
+    CheckpointProgress checkpoint_progress{&checkpoint};
+    CheckpointState state{};
+    auto resumed = false;
+    if (Options.checkpoint) {
+      if (!checkpoint.Initialize(Options.checkpoint, Options.url, &state,
+                                 &resumed))
+        return 1;
+      if (resumed && !Resume(state, &unzip_options)) return 1;
+      unzip_options.progress = &checkpoint_progress;
+    }
+    DirectoryCache directories;
+    FilePool file_pool;
+    if (Options.file_threads)
+      file_pool.Initialize(Options.file_threads, &directories, stats);
+    // updated files are rewritten, so are entries past a checkpoint, which
+    // might be written partially. --update compares modification times, so
+    // it's the one to stamp them on files.
+    FileEntrySinkFactory file_sinks;
+    file_sinks.Initialize(Options.overwrite || Options.update || resumed,
+                          Options.update, Options.write_buffers,
+                          Options.preallocate, Options.map_size, &directories,
+                          Options.file_threads ? &file_pool : nullptr, stats);
+    DiscardEntrySinkFactory discard_sinks;
+    TarEntrySinkFactory tar_sinks;
+    if (Options.tar) {
+      tar_sinks.Initialize(GetStdHandle(STD_OUTPUT_HANDLE), Options.max_held);
+      unzip_options.sinks = &tar_sinks;
+    } else if (Options.dryrun) {
+      unzip_options.sinks = &discard_sinks;
+    } else {
+      unzip_options.sinks = &file_sinks;
+    }
+    // a resumed hash goes on from the checkpoint
+    if (Options.sha256 &&
+        !Sha256.Initialize(StreamOffset ? &state.sha256 : nullptr,
+                           StreamOffset, stats))
+      return 1;
+    if (Options.input) {
+      auto ok = UnzipInput(&unzip_options);
+      // a failed archive isn't ended, so the tar stream reads as truncated
+      if (ok && Options.tar) ok = tar_sinks.Finish();
+      if (Options.update && !Options.dryrun) ok = update_index.Save() && ok;
+      if (Options.entry_sha256 && !Options.dryrun) ok = digests.Save() && ok;
+      return ok ? 0 : 1;
+    }
+    CURLBytestreamOptions curl_bytestream_options{};
+    curl_bytestream_options.max_buffer = Options.max_buffer;
+    curl_bytestream_options.stats = stats;
+    curl_bytestream_options.trace = trace;
+    if (Options.network_thread)
+      curl_bytestream_options.ring_size = Options.ring_size;
+    if (Options.batch) {
+      curl_bytestream_options.ring_size = Options.ring_size;
+      Batch batch;
+      auto ok = batch.Initialize(curl.get(), &share, &curl_bytestream_options,
+                                 &unzip_options, Options.dryrun) &&
+                batch.Run(batch_items, Options.jobs);
+      if (Options.update && !Options.dryrun) ok = update_index.Save() && ok;
+      if (Options.entry_sha256 && !Options.dryrun) ok = digests.Save() && ok;
+      return ok ? 0 : 1;
+    }
+    if (Options.ranges) {
+      CURLRangeSource range_source;
+      if (range_source.Initialize(curl.get(), Options.ranges,
+                                  &curl_bytestream_options)) {
+        auto ok = Unzip(&range_source, &unzip_options);
+        if (ok && Options.tar) ok = tar_sinks.Finish();
+        // files extracted before a failure stay indexed
+        if (Options.update && !Options.dryrun) ok = update_index.Save() && ok;
+        if (Options.entry_sha256 && !Options.dryrun)
+          ok = digests.Save() && ok;
+        if (ok) {
+          checkpoint.Remove();
+          return 0;
+        }
+        if (!range_source.ranges_supported())
+          std::cerr << "server doesn't support range requests" << std::endl;
+        return 1;
+      }
+      if (range_source.ranges_supported()) return 1;
+      if (Options.verbose)
+        std::cerr << "server doesn't support range requests, "
+                     "falling back to a single download"
+                  << std::endl;
+    }
+    if (StreamOffset) {
+      curl_easy_setopt(curl.get(), CURLOPT_RESUME_FROM_LARGE,
+                       static_cast<curl_off_t>(StreamOffset));
+      curl_easy_setopt(curl.get(), CURLOPT_HEADERFUNCTION,
+                       CURLResumeHeaderFunction);
+    }
+    if (Options.sha256) curl_bytestream_options.sha256 = &Sha256;
+    CURLBytestreamAdapter curl_bytestream_adapter{
+        Options.save ? CURLSaveFunction : nullptr};
+    if (!curl_bytestream_adapter.Initialize(curl.get(),
+                                            &curl_bytestream_options))
+      return 1;
     if (Options.save)
       curl_easy_setopt(curl.get(), CURLOPT_HEADERFUNCTION, CURLHeaderFunction);
-    if (Options.sha256) Sha256Error = !Sha256.Initialize();
-    UnzipOptions unzip_options{};
-    unzip_options.overwrite = Options.overwrite;
-    unzip_options.dryrun = Options.dryrun;
     auto ok = Unzip(&curl_bytestream_adapter, &unzip_options);
     if (Options.save || Options.sha256) {
       curl_bytestream_adapter.RunToTheEnd();
-      if (Options.sha256) {
-        if (!Sha256.Finish(Sha256Bytes))
-          ok = false;
-        else if (!std::equal(std::cbegin(Sha256Bytes), std::cend(Sha256Bytes),
-                             std::cbegin(Options.sha256_bytes))) {
-          ok = false;
-          std::cerr << "SHA-256 hash doesn't match" << std::endl;
-        }
-      }
+      if (Options.sha256 && !VerifySha256()) ok = false;
     }
+    if (ok && Options.tar) ok = tar_sinks.Finish();
+    if (Options.verbose)
+      std::cerr << "peak buffered bytes: "
+                << curl_bytestream_adapter.peak_buffered() << std::endl;
+    if (Options.update && !Options.dryrun) ok = update_index.Save() && ok;
+    if (Options.entry_sha256 && !Options.dryrun) ok = digests.Save() && ok;
+    if (ok) checkpoint.Remove();
     return ok ? 0 : 1;
   } catch (std::exception &e) {
     std::cerr << e.what() << std::endl;
     return 1;
   }
+}
+
+int main(int argc, char *argv[]) {
+  auto result = Run(argc, argv);
+  // standard output might carry a tar stream
+  if (Options.stats) RunStats.Print(std::cerr);
+  if (Options.trace && !RunTrace.Save(Options.trace)) result = 1;
+  return result;
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "stdafx.h"
+
+#include "mapped_file_source.h"
+
+#include "memory_bytestream.h"
+#include "zip_format.h"
+
+namespace {
+
+// the same tail CURLRangeSource reads
+constexpr std::size_t kTailSize =
+    (std::max)(sizeof(std::uint32_t) + sizeof(EndOfCentralDirectoryRecord) +
+                   0xffff,
+               static_cast<std::size_t>(0x40000));  // 256 KiB
+
+}  // namespace
+
+MappedFileSource::MappedFileSource(curl_write_callback callback,
+                                   PVOID callback_data)
+    : callback_{callback}, callback_data_{callback_data} {}
+
+bool MappedFileSource::Initialize(PCSTR path) {
+  assert(!file_);
+  auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    std::cerr << "error opening file " << path << " (code " << error << ')'
+              << std::endl;
+    return false;
+  }
+  file_.reset(file);
+  LARGE_INTEGER size{};
+  if (!GetFileSizeEx(file, &size)) {
+    auto error = GetLastError();
+    std::cerr << "error getting size of file " << path << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  // 32-bit builds map up to what fits the address space
+  if (static_cast<std::uint64_t>(size.QuadPart) > SIZE_MAX) {
+    std::cerr << "file " << path << " is too large to be mapped" << std::endl;
+    return false;
+  }
+  size_ = static_cast<std::size_t>(size.QuadPart);
+  // an empty file can't be mapped, it reads as an empty stream
+  if (!size_) return true;
+  auto mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping) {
+    mapping_.reset(mapping);
+    auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view) {
+      view_.reset(view);
+      data_ = static_cast<PBYTE>(view);
+      return true;
+    }
+  }
+  auto error = GetLastError();
+  std::cerr << "error mapping file " << path << " (code " << error << ')'
+            << std::endl;
+  return false;
+}
+
+void MappedFileSource::RunToTheEnd() { Pass(size_); }
+
+bool MappedFileSource::Read(PVOID ptr, std::size_t size, std::size_t* read) {
+  auto read_size = (std::min)(size, size_ - pos_);
+  *read = read_size;
+  // an empty file has no view to copy from
+  if (!read_size) return true;
+  std::memcpy(ptr, data_ + pos_, read_size);
+  Consume(read_size);
+  return true;
+}
+
+bool MappedFileSource::Peek(PBYTE* ptr, std::size_t* size) {
+  *ptr = data_ + pos_;
+  *size = size_ - pos_;
+  return true;
+}
+
+void MappedFileSource::Consume(std::size_t size) {
+  assert(size <= size_ - pos_);
+  pos_ += size;
+  Pass(pos_);
+}
+
+bool MappedFileSource::ReadTail(std::uint64_t* offset,
+                                std::vector<BYTE>* data) {
+  auto size = (std::min)(size_, kTailSize);
+  *offset = size_ - size;
+  data->assign(data_ + (size_ - size), data_ + size_);
+  return true;
+}
+
+bool MappedFileSource::Request(std::uint64_t offset, std::size_t size,
+                               std::size_t tag) {
+  if (size_ < offset || size_ - offset < size) {
+    std::cerr << "unsupported or invalid zip file format" << std::endl;
+    return false;
+  }
+  auto begin = data_ + static_cast<std::size_t>(offset);
+  completed_.emplace_back(tag, std::vector<BYTE>(begin, begin + size));
+  return true;
+}
+
+bool MappedFileSource::Wait(std::size_t* tag, std::vector<BYTE>* data) {
+  // requests complete right away, in order
+  if (completed_.empty()) return false;
+  *tag = completed_.front().first;
+  *data = std::move(completed_.front().second);
+  completed_.pop_front();
+  return true;
+}
+
+std::unique_ptr<IBytestream> MappedFileSource::Stream(std::uint64_t offset,
+                                                      std::uint64_t size) {
+  assert(size);
+  if (size_ < offset || size_ - offset < size) {
+    std::cerr << "unsupported or invalid zip file format" << std::endl;
+    return nullptr;
+  }
+  // large entries are read from the mapping in place
+  auto stream = std::make_unique<MemoryBytestream>();
+  stream->Reset(data_ + static_cast<std::size_t>(offset),
+                static_cast<std::size_t>(size));
+  return std::move(stream);
+}
+
+void MappedFileSource::Pass(std::size_t end) {
+  if (!callback_ || end <= passed_) return;
+  callback_(reinterpret_cast<PSTR>(data_ + passed_), 1, end - passed_,
+            callback_data_);
+  passed_ = end;
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+// Reads an archive on disk through a mapping of the whole file. As a stream
+// it hands out the mapping itself, zero-copy. As a range source it lets the
+// central directory drive extraction the way ranges of a URL do.
+class MappedFileSource : public IBytestream, public IRangeSource {
+ public:
+  // callback sees the data as it's consumed, with callback_data as userdata,
+  // the way CURLBytestreamAdapter reports downloaded data
+  explicit MappedFileSource(curl_write_callback callback = nullptr,
+                            PVOID callback_data = nullptr);
+  MappedFileSource(const MappedFileSource& other) = delete;
+  MappedFileSource(MappedFileSource&& other) = delete;
+  MappedFileSource& operator=(const MappedFileSource& other) = delete;
+  MappedFileSource& operator=(MappedFileSource&& other) = delete;
+
+  bool Initialize(PCSTR path);
+  // Passes the rest of the file to the callback.
+  void RunToTheEnd();
+
+ private:
+  // IBytestream
+  bool Read(PVOID ptr, std::size_t size, std::size_t* read);
+  bool Peek(PBYTE* ptr, std::size_t* size);
+  void Consume(std::size_t size);
+  // IRangeSource
+  bool ReadTail(std::uint64_t* offset, std::vector<BYTE>* data);
+  bool Request(std::uint64_t offset, std::size_t size, std::size_t tag);
+  bool Wait(std::size_t* tag, std::vector<BYTE>* data);
+  std::unique_ptr<IBytestream> Stream(std::uint64_t offset,
+                                      std::uint64_t size);
+  // hands the data up to end over to the callback
+  void Pass(std::size_t end);
+
+  curl_write_callback callback_;
+  PVOID callback_data_;
+  std::unique_ptr<void, decltype(&CloseHandle)> file_{nullptr, CloseHandle};
+  std::unique_ptr<void, decltype(&CloseHandle)> mapping_{nullptr,
+                                                         CloseHandle};
+  std::unique_ptr<void, decltype(&UnmapViewOfFile)> view_{nullptr,
+                                                          UnmapViewOfFile};
+  PBYTE data_{nullptr};
+  std::size_t size_{0};
+  std::size_t pos_{0};     // of the stream
+  std::size_t passed_{0};  // to the callback
+  // requested ranges, copied since the caller owns the buffers
+  std::deque<std::pair<std::size_t, std::vector<BYTE>>> completed_;
+};
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include "stdafx.h"
+
+#include "memory_bytestream.h"
+
+void MemoryBytestream::Reset(PBYTE ptr, std::size_t size) {
+  ptr_ = ptr;
+  size_ = size;
+}
+
+bool MemoryBytestream::Read(PVOID ptr, std::size_t size, std::size_t* read) {
+  auto read_size = (std::min)(size, size_);
+  std::memcpy(ptr, ptr_, read_size);
+  Consume(read_size);
+  *read = read_size;
+  return true;
+}
+
+bool MemoryBytestream::Peek(PBYTE* ptr, std::size_t* size) {
+  *ptr = ptr_;
+  *size = size_;
+  return true;
+}
+
+void MemoryBytestream::Consume(std::size_t size) {
+  assert(size <= size_);
+  ptr_ += size;
+  size_ -= size;
+}
\ No newline at end of file
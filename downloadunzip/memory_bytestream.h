@@ -0,0 +1,20 @@
+#pragma once
+
+class MemoryBytestream : public IBytestream {
+ public:
+  MemoryBytestream() = default;
+  MemoryBytestream(const MemoryBytestream& other) = delete;
+  MemoryBytestream(MemoryBytestream&& other) = delete;
+  MemoryBytestream& operator=(const MemoryBytestream& other) = delete;
+  MemoryBytestream& operator=(MemoryBytestream&& other) = delete;
+
+  void Reset(PBYTE ptr, std::size_t size);
+
+ private:
+  bool Read(PVOID ptr, std::size_t size, std::size_t* read);
+  bool Peek(PBYTE* ptr, std::size_t* size);
+  void Consume(std::size_t size);
+
+  PBYTE ptr_{nullptr};
+  std::size_t size_{0};
+};
\ No newline at end of file
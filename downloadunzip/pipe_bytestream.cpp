@@ -0,0 +1,86 @@
+#include "stdafx.h"
+
+#include "pipe_bytestream.h"
+
+namespace {
+
+constexpr std::size_t kBufferSize = 0x400000;  // 4 MiB
+
+}  // namespace
+
+PipeBytestream::PipeBytestream(curl_write_callback callback,
+                               PVOID callback_data)
+    : callback_{callback}, callback_data_{callback_data} {}
+
+bool PipeBytestream::Initialize(HANDLE pipe) {
+  assert(!buffer_);
+  if (!pipe || pipe == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    std::cerr << "error getting standard input (code " << error << ')'
+              << std::endl;
+    return false;
+  }
+  pipe_ = pipe;
+  buffer_.reset(new BYTE[kBufferSize]);
+  return true;
+}
+
+void PipeBytestream::RunToTheEnd() {
+  for (begin_ = end_; !eof_ && Fill(); begin_ = end_)
+    ;
+}
+
+bool PipeBytestream::Read(PVOID ptr, std::size_t size, std::size_t* read) {
+  auto out = static_cast<PBYTE>(ptr);
+  *read = 0;
+  while (size) {
+    if (begin_ == end_ && !Fill()) return false;
+    if (begin_ == end_) break;  // end of the pipe
+    auto read_size = (std::min)(size, end_ - begin_);
+    std::memcpy(out, buffer_.get() + begin_, read_size);
+    begin_ += read_size;
+    out += read_size;
+    size -= read_size;
+    *read += read_size;
+  }
+  return true;
+}
+
+bool PipeBytestream::Peek(PBYTE* ptr, std::size_t* size) {
+  if (begin_ == end_ && !Fill()) return false;
+  *ptr = buffer_.get() + begin_;
+  *size = end_ - begin_;
+  return true;
+}
+
+void PipeBytestream::Consume(std::size_t size) {
+  assert(size <= end_ - begin_);
+  begin_ += size;
+}
+
+bool PipeBytestream::Fill() {
+  assert(begin_ == end_);
+  begin_ = 0;
+  end_ = 0;
+  if (eof_) return true;
+  // returns what the pipe holds, up to the whole buffer
+  DWORD read = 0;
+  if (!ReadFile(pipe_, buffer_.get(), static_cast<DWORD>(kBufferSize), &read,
+                NULL)) {
+    auto error = GetLastError();
+    // the writing end is closed
+    if (error == ERROR_BROKEN_PIPE) {
+      eof_ = true;
+      return true;
+    }
+    std::cerr << "error reading standard input (code " << error << ')'
+              << std::endl;
+    return false;
+  }
+  // a redirected file reads nothing at its end
+  if (!read) eof_ = true;
+  end_ = read;
+  if (callback_ && read)
+    callback_(reinterpret_cast<PSTR>(buffer_.get()), 1, read, callback_data_);
+  return true;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+// Reads an archive from a pipe, standard input by default, in large reads
+// so that a producer on the other end isn't stalled by small ones.
+class PipeBytestream : public IBytestream {
+ public:
+  // callback sees all data read, with callback_data as userdata, the way
+  // CURLBytestreamAdapter reports downloaded data
+  explicit PipeBytestream(curl_write_callback callback = nullptr,
+                          PVOID callback_data = nullptr);
+  PipeBytestream(const PipeBytestream& other) = delete;
+  PipeBytestream(PipeBytestream&& other) = delete;
+  PipeBytestream& operator=(const PipeBytestream& other) = delete;
+  PipeBytestream& operator=(PipeBytestream&& other) = delete;
+
+  // The pipe isn't closed, it belongs to the caller.
+  bool Initialize(HANDLE pipe = GetStdHandle(STD_INPUT_HANDLE));
+  // Reads the rest of the pipe, so the callback sees all of it.
+  void RunToTheEnd();
+
+ private:
+  bool Read(PVOID ptr, std::size_t size, std::size_t* read);
+  bool Peek(PBYTE* ptr, std::size_t* size);
+  void Consume(std::size_t size);
+  bool Fill();
+
+  curl_write_callback callback_;
+  PVOID callback_data_;
+  HANDLE pipe_{INVALID_HANDLE_VALUE};
+  std::unique_ptr<BYTE[]> buffer_;
+  std::size_t begin_{0};  // of the data not consumed yet
+  std::size_t end_{0};
+  bool eof_{false};
+};
\ No newline at end of file
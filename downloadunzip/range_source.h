@@ -0,0 +1,18 @@
+#pragma once
+
+// Random access to an archive, lets the central directory drive extraction.
+struct IRangeSource {
+  virtual ~IRangeSource() = default;
+  // Reads the end of the archive, enough to hold the end of central directory
+  // record with the longest comment. *offset receives the position of the
+  // first byte read.
+  virtual bool ReadTail(std::uint64_t* offset, std::vector<BYTE>* data) = 0;
+  // Starts reading size bytes at offset. Reads complete in any order, Wait()
+  // reports each one with the tag it was requested with.
+  virtual bool Request(std::uint64_t offset, std::size_t size,
+                       std::size_t tag) = 0;
+  virtual bool Wait(std::size_t* tag, std::vector<BYTE>* data) = 0;
+  // Streams a range too big to be read in one go.
+  virtual std::unique_ptr<IBytestream> Stream(std::uint64_t offset,
+                                              std::uint64_t size) = 0;
+};
\ No newline at end of file
@@ -1,41 +1,204 @@
 #include "stdafx.h"
-
+// https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.180-4.pdf
 #include "sha256.h"
 
-SHA256::~SHA256() {
-  BCryptDestroyHash(hash_);
-  BCryptCloseAlgorithmProvider(alg_, 0);
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#define SHA256_SHANI
+#endif
+
+namespace {
+
+constexpr std::size_t kBlockSize = 64;
+
+constexpr std::uint32_t kInitialHash[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+constexpr std::uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+inline std::uint32_t RotateRight(std::uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
 }
 
-bool SHA256::Initialize() {
-  assert(!alg_);
-  assert(!hash_);
-  auto res =
-      BCryptOpenAlgorithmProvider(&alg_, BCRYPT_SHA256_ALGORITHM, NULL, 0);
-  if (!BCRYPT_SUCCESS(res)) {
-    std::cerr << "error opening SHA-256 BCrypt algorithm provider (code " << res
-              << ")" << std::endl;
-    return false;
+inline std::uint32_t LoadBigEndian(PBYTE ptr) {
+  return (static_cast<std::uint32_t>(ptr[0]) << 24) |
+         (static_cast<std::uint32_t>(ptr[1]) << 16) |
+         (static_cast<std::uint32_t>(ptr[2]) << 8) | ptr[3];
+}
+
+void TransformScalar(std::uint32_t (&state)[8], PBYTE blocks,
+                     std::size_t count) {
+  std::uint32_t w[64];
+  for (; count; --count, blocks += kBlockSize) {
+    for (auto i = 0; i < 16; ++i) w[i] = LoadBigEndian(blocks + i * 4);
+    for (auto i = 16; i < 64; ++i) {
+      auto s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^
+                (w[i - 15] >> 3);
+      auto s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^
+                (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    auto a = state[0], b = state[1], c = state[2], d = state[3];
+    auto e = state[4], f = state[5], g = state[6], h = state[7];
+    for (auto i = 0; i < 64; ++i) {
+      auto s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+      auto ch = (e & f) ^ (~e & g);
+      auto t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+      auto s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+      auto maj = (a & b) ^ (a & c) ^ (b & c);
+      auto t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef SHA256_SHANI
+
+// https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+void TransformShaNi(std::uint32_t (&state)[8], PBYTE blocks,
+                    std::size_t count) {
+  const auto kByteSwap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+  // the instructions keep the state as ABEF and CDGH
+  auto tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+  auto state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+  tmp = _mm_shuffle_epi32(tmp, 0xb1);        // CDAB
+  state1 = _mm_shuffle_epi32(state1, 0x1b);  // EFGH
+  auto state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+  for (; count; --count, blocks += kBlockSize) {
+    auto abef = state0;
+    auto cdgh = state1;
+    // four rounds per group, the schedule runs three groups ahead
+    __m128i w[4];
+    for (auto i = 0; i < 16; ++i) {
+      auto& w0 = w[i % 4];
+      if (i < 4)
+        w0 = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + i * 16)),
+            kByteSwap);
+      auto k = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(kRoundConstants + i * 4));
+      auto msg = _mm_add_epi32(w0, k);
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      if (3 <= i && i <= 14) {
+        auto& w1 = w[(i + 1) % 4];
+        w1 = _mm_add_epi32(w1, _mm_alignr_epi8(w0, w[(i + 3) % 4], 4));
+        w1 = _mm_sha256msg2_epu32(w1, w0);
+      }
+      msg = _mm_shuffle_epi32(msg, 0x0e);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+      if (1 <= i && i <= 12) {
+        auto& w3 = w[(i + 3) % 4];
+        w3 = _mm_sha256msg1_epu32(w3, w0);
+      }
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
   }
-  res = BCryptCreateHash(alg_, &hash_, NULL, 0, NULL, 0, 0);
-  if (BCRYPT_SUCCESS(res)) return true;
-  std::cerr << "error creating SHA-256 BCrypt hash (code " << res << ")"
-            << std::endl;
-  return false;
+  tmp = _mm_shuffle_epi32(state0, 0x1b);     // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xb1);  // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+bool HasShaNi() {
+  int info[4] = {};
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  constexpr int kSsse3 = 1 << 9;
+  constexpr int kSse41 = 1 << 19;
+  if (!(info[2] & kSsse3) || !(info[2] & kSse41)) return false;
+  __cpuidex(info, 7, 0);
+  constexpr int kSha = 1 << 29;
+  return (info[1] & kSha) != 0;
+}
+
+#endif  // SHA256_SHANI
+
+using TransformProc = void (*)(std::uint32_t (&state)[8], PBYTE blocks,
+                               std::size_t count);
+
+TransformProc SelectTransform() {
+#ifdef SHA256_SHANI
+  if (HasShaNi()) return TransformShaNi;
+#endif
+  return TransformScalar;
+}
+
+}  // namespace
+
+bool SHA256::Initialize() {
+  state_ = SHA256State{};
+  std::copy(std::begin(kInitialHash), std::end(kInitialHash), state_.h);
+  return true;
 }
 
 bool SHA256::Hash(PBYTE ptr, std::size_t size) {
-  auto res = BCryptHashData(hash_, ptr, size, 0);
-  if (BCRYPT_SUCCESS(res)) return true;
-  std::cerr << "error updating SHA-256 BCrypt hash (code " << res << ")"
-            << std::endl;
-  return false;
+  auto pending = static_cast<std::size_t>(state_.size % kBlockSize);
+  state_.size += size;
+  if (pending) {
+    auto fill = (std::min)(size, kBlockSize - pending);
+    std::memcpy(state_.block + pending, ptr, fill);
+    ptr += fill;
+    size -= fill;
+    if (pending + fill < kBlockSize) return true;
+    Transform(state_.block, 1);
+  }
+  Transform(ptr, size / kBlockSize);
+  std::memcpy(state_.block, ptr + size / kBlockSize * kBlockSize,
+              size % kBlockSize);
+  return true;
 }
 
 bool SHA256::Finish(BYTE (&bytes)[32]) {
-  auto res = BCryptFinishHash(hash_, bytes, sizeof(bytes), 0);
-  if (BCRYPT_SUCCESS(res)) return true;
-  std::cerr << "error finalizing SHA-256 BCrypt hash (code " << res << ")"
-            << std::endl;
-  return false;
+  // append 0x80, pad with zeros and end with the message length in bits
+  auto bits = state_.size * 8;
+  BYTE padding[kBlockSize * 2]{0x80};
+  auto pending = static_cast<std::size_t>(state_.size % kBlockSize);
+  auto padding_size = (pending < 56 ? 56 : 120) - pending;
+  for (auto i = 0; i < 8; ++i)
+    padding[padding_size + i] = static_cast<BYTE>(bits >> (56 - i * 8));
+  Hash(padding, padding_size + 8);
+  assert(state_.size % kBlockSize == 0);
+  for (auto i = 0; i < 8; ++i)
+    for (auto j = 0; j < 4; ++j)
+      bytes[i * 4 + j] = static_cast<BYTE>(state_.h[i] >> (24 - j * 8));
+  return true;
+}
+
+void SHA256::Transform(PBYTE blocks, std::size_t count) {
+  static const auto Proc = SelectTransform();
+  if (count) Proc(state_.h, blocks, count);
 }
\ No newline at end of file
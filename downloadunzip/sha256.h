@@ -1,9 +1,15 @@
 #pragma once
 
+// Unfinished hash, can be saved and restored to continue hashing later.
+struct SHA256State {
+  std::uint32_t h[8];
+  std::uint64_t size;  // bytes hashed so far
+  BYTE block[64];      // the trailing size % 64 bytes wait for a full block
+};
+
 class SHA256 {
  public:
   SHA256() = default;
-  ~SHA256();
   SHA256(const SHA256& other) = delete;
   SHA256(SHA256&& other) = delete;
   SHA256& operator=(const SHA256& other) = delete;
@@ -12,8 +18,11 @@ class SHA256 {
   bool Initialize();
   bool Hash(PBYTE ptr, std::size_t size);
   bool Finish(BYTE (&bytes)[32]);
+  const SHA256State& state() const { return state_; }
+  void Restore(const SHA256State& state) { state_ = state; }
 
  private:
-  BCRYPT_ALG_HANDLE alg_{nullptr};
-  BCRYPT_HASH_HANDLE hash_{nullptr};
+  void Transform(PBYTE blocks, std::size_t count);
+
+  SHA256State state_{};
 };
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "stdafx.h"
+
+#include "sha256_worker.h"
+
+#include "stats.h"
+
+namespace {
+
+constexpr std::size_t kMaxQueuedSize = 0x1000000;  // 16 MiB
+
+}  // namespace
+
+SHA256Worker::~SHA256Worker() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    finished_ = true;
+    pieces_.clear();
+  }
+  queued_cv_.notify_one();
+  thread_.join();
+}
+
+bool SHA256Worker::Initialize(const SHA256State* state, std::uint64_t offset,
+                              Stats* stats) {
+  assert(!thread_.joinable());
+  stats_ = stats;
+  if (!sha256_.Initialize()) return false;
+  if (state) sha256_.Restore(*state);
+  state_ = sha256_.state();
+  offset_ = offset;
+  size_ = state_.size;
+  thread_ = std::thread{&SHA256Worker::Run, this};
+  return true;
+}
+
+void SHA256Worker::Hash(PCSTR ptr, std::size_t size) {
+  auto skip = Skip(size);
+  ptr += skip;
+  size -= skip;
+  while (size) {
+    if (!chunk_ || chunk_->size == Chunk::kCapacity) chunk_ = pool_.Allocate();
+    auto begin = chunk_->size;
+    auto copy_size = (std::min)(size, Chunk::kCapacity - begin);
+    std::memcpy(chunk_->data + begin, ptr, copy_size);
+    // the worker never reads past end, so the rest can still be filled
+    chunk_->size += copy_size;
+    ptr += copy_size;
+    size -= copy_size;
+    Queue(chunk_, begin, chunk_->size);
+  }
+}
+
+void SHA256Worker::Hash(const ChunkRef& chunk, std::size_t begin,
+                        std::size_t end) {
+  begin += Skip(end - begin);
+  if (begin != end) Queue(chunk, begin, end);
+}
+
+std::size_t SHA256Worker::Skip(std::size_t size) {
+  // a resumed download repeats what was hashed past the checkpoint
+  std::size_t skip = 0;
+  if (offset_ < size_)
+    skip = static_cast<std::size_t>(
+        (std::min)(size_ - offset_, static_cast<std::uint64_t>(size)));
+  offset_ += size;
+  size_ += size - skip;
+  return skip;
+}
+
+void SHA256Worker::Queue(const ChunkRef& chunk, std::size_t begin,
+                         std::size_t end) {
+  {
+    // memory stays bounded if hashing can't keep up
+    std::unique_lock<std::mutex> lock{mutex_};
+    hashed_cv_.wait(lock, [this] { return queued_ < kMaxQueuedSize; });
+    pieces_.push_back(Piece{chunk, begin, end});
+    queued_ += end - begin;
+  }
+  queued_cv_.notify_one();
+}
+
+SHA256State SHA256Worker::State(std::uint64_t size) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  hashed_cv_.wait(lock, [this, size] { return size <= state_.size; });
+  return state_;
+}
+
+bool SHA256Worker::Finish(BYTE (&bytes)[32]) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    finished_ = true;
+  }
+  queued_cv_.notify_one();
+  thread_.join();
+  chunk_.Reset();
+  return sha256_.Finish(bytes);
+}
+
+void SHA256Worker::Run() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  for (;;) {
+    queued_cv_.wait(lock, [this] { return finished_ || !pieces_.empty(); });
+    if (pieces_.empty()) return;
+    auto piece = std::move(pieces_.front());
+    pieces_.pop_front();
+    lock.unlock();
+    auto size = piece.end - piece.begin;
+    {
+      StageTimer timer{stats_, Stats::Stage::kSha256};
+      sha256_.Hash(piece.chunk->data + piece.begin, size);
+      timer.Add(size);
+    }
+    piece.chunk.Reset();
+    lock.lock();
+    queued_ -= size;
+    state_ = sha256_.state();
+    hashed_cv_.notify_all();
+  }
+}
\ No newline at end of file
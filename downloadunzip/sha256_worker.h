@@ -0,0 +1,64 @@
+#pragma once
+#include "chunk_pool.h"
+#include "sha256.h"
+
+class Stats;
+
+// Hashes on a thread of its own, so producers only copy data into pooled
+// chunks, or queue references to chunks that hold it already. Data handed
+// over in one call is queued at once, while the chunk it's in is still being
+// filled with the next calls.
+class SHA256Worker {
+ public:
+  SHA256Worker() = default;
+  ~SHA256Worker();
+  SHA256Worker(const SHA256Worker& other) = delete;
+  SHA256Worker(SHA256Worker&& other) = delete;
+  SHA256Worker& operator=(const SHA256Worker& other) = delete;
+  SHA256Worker& operator=(SHA256Worker&& other) = delete;
+
+  // state continues an earlier hash, nullptr starts a new one. The data
+  // handed over starts at offset, what of it the state covers is skipped.
+  // Hashing is counted to stats unless it's nullptr.
+  bool Initialize(const SHA256State* state, std::uint64_t offset,
+                  Stats* stats = nullptr);
+  // producer side, copies the data
+  void Hash(PCSTR ptr, std::size_t size);
+  // producer side, queues the data of chunk from begin to end by reference,
+  // it may not change any more, the chunk may be filled on past end
+  void Hash(const ChunkRef& chunk, std::size_t begin, std::size_t end);
+  // Chunks referenced by the queue come from here, it outlives the queue.
+  ChunkPool* pool() { return &pool_; }
+  // Waits until at least size bytes are hashed.
+  SHA256State State(std::uint64_t size);
+  // Waits for the queued data, digest verification right after the last byte
+  // costs no more than hashing what was still in flight.
+  bool Finish(BYTE (&bytes)[32]);
+
+ private:
+  struct Piece {
+    ChunkRef chunk;
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  // Skips the part of size bytes handed over that is hashed already.
+  std::size_t Skip(std::size_t size);
+  void Queue(const ChunkRef& chunk, std::size_t begin, std::size_t end);
+  void Run();
+
+  SHA256 sha256_;
+  Stats* stats_{nullptr};
+  ChunkPool pool_;
+  ChunkRef chunk_;  // being filled
+  std::uint64_t offset_{0};  // of the data handed over next
+  std::uint64_t size_{0};    // of the data queued so far
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable hashed_cv_;
+  std::deque<Piece> pieces_;
+  std::size_t queued_{0};  // bytes in pieces_ and the one being hashed
+  SHA256State state_{};  // as of the last hashed piece
+  bool finished_{false};
+};
\ No newline at end of file
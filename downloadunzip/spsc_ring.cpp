@@ -0,0 +1,40 @@
+#include "stdafx.h"
+
+#include "spsc_ring.h"
+
+bool SpscRing::Initialize(std::size_t capacity) {
+  assert(!buffer_);
+  std::size_t size = 1;
+  for (; size < capacity; size <<= 1)
+    if (!size) return false;  // overflow
+  buffer_.reset(new (std::nothrow) BYTE[size]);
+  if (!buffer_) return false;
+  mask_ = size - 1;
+  return true;
+}
+
+std::size_t SpscRing::Write(PCSTR ptr, std::size_t size) {
+  auto head = head_.load(std::memory_order_relaxed);
+  auto tail = tail_.load(std::memory_order_acquire);
+  size = (std::min)(size, capacity() - (head - tail));
+  auto pos = head & mask_;
+  auto first = (std::min)(size, capacity() - pos);
+  std::memcpy(buffer_.get() + pos, ptr, first);
+  std::memcpy(buffer_.get(), ptr + first, size - first);
+  head_.store(head + size, std::memory_order_release);
+  return size;
+}
+
+void SpscRing::Peek(PBYTE* ptr, std::size_t* size) {
+  auto tail = tail_.load(std::memory_order_relaxed);
+  auto head = head_.load(std::memory_order_acquire);
+  auto pos = tail & mask_;
+  *ptr = buffer_.get() + pos;
+  *size = (std::min)(head - tail, capacity() - pos);
+}
+
+void SpscRing::Consume(std::size_t size) {
+  auto tail = tail_.load(std::memory_order_relaxed);
+  assert(size <= head_.load(std::memory_order_acquire) - tail);
+  tail_.store(tail + size, std::memory_order_release);
+}
\ No newline at end of file
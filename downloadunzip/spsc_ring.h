@@ -0,0 +1,28 @@
+#pragma once
+
+// Lock-free byte ring for exactly one producer and one consumer thread.
+// Positions grow monotonically, the capacity is a power of two.
+class SpscRing {
+ public:
+  SpscRing() = default;
+  SpscRing(const SpscRing& other) = delete;
+  SpscRing(SpscRing&& other) = delete;
+  SpscRing& operator=(const SpscRing& other) = delete;
+  SpscRing& operator=(SpscRing&& other) = delete;
+
+  bool Initialize(std::size_t capacity);
+  // producer side, returns the number of bytes that fit
+  std::size_t Write(PCSTR ptr, std::size_t size);
+  // consumer side
+  void Peek(PBYTE* ptr, std::size_t* size);
+  void Consume(std::size_t size);
+
+  std::size_t capacity() const { return mask_ + 1; }
+  std::size_t size() const { return head_.load() - tail_.load(); }
+
+ private:
+  std::unique_ptr<BYTE[]> buffer_;
+  std::size_t mask_{0};
+  alignas(64) std::atomic<std::size_t> head_{0};  // advanced by the producer
+  alignas(64) std::atomic<std::size_t> tail_{0};  // advanced by the consumer
+};
\ No newline at end of file
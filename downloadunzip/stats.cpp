@@ -0,0 +1,41 @@
+#include "stdafx.h"
+
+#include "stats.h"
+
+namespace {
+
+constexpr PCSTR kStageNames[] = {"network", "network_wait", "inflate",
+                                 "unzstd",  "crc32",        "sha256",
+                                 "write",   "disk"};
+static_assert(std::size(kStageNames) ==
+                  static_cast<std::size_t>(Stats::Stage::kCount),
+              "every stage has a name");
+
+}  // namespace
+
+Stats::Stats() : start_{Now()} {}
+
+void Stats::Buffered(std::uint64_t size) {
+  auto peak = peak_buffered_.load(std::memory_order_relaxed);
+  while (peak < size && !peak_buffered_.compare_exchange_weak(
+                            peak, size, std::memory_order_relaxed))
+    ;
+}
+
+void Stats::Print(std::ostream& out) const {
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  auto seconds = [&frequency](std::uint64_t ticks) {
+    return static_cast<double>(ticks) /
+           static_cast<double>(frequency.QuadPart);
+  };
+  out << "{\"seconds\":" << seconds(Now() - start_)
+      << ",\"peak_buffered\":" << peak_buffered_ << ",\"stages\":{";
+  for (std::size_t i = 0; i < std::size(kStageNames); ++i) {
+    auto& counter = counters_[i];
+    out << (i ? "," : "") << '"' << kStageNames[i] << "\":{\"seconds\":"
+        << seconds(counter.ticks) << ",\"bytes\":" << counter.bytes
+        << ",\"calls\":" << counter.calls << '}';
+  }
+  out << "}}" << std::endl;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+// Time, bytes and calls per stage of a run, counted from any thread. A
+// counted call costs two performance counter reads and three relaxed atomic
+// adds to a cache line of the stage's own.
+class Stats {
+ public:
+  enum class Stage {
+    kNetwork,      // running the transfer, bytes received
+    kNetworkWait,  // the consumer waiting for data to arrive
+    kInflate,      // bytes inflated
+    kUnzstd,       // bytes decompressed
+    kCrc32,
+    kSha256,
+    kWrite,  // handing entries to sinks, bytes of entry data
+    kDisk,   // files written by I/O threads and the file pool, bytes written
+    kCount
+  };
+
+  Stats();
+  Stats(const Stats& other) = delete;
+  Stats(Stats&& other) = delete;
+  Stats& operator=(const Stats& other) = delete;
+  Stats& operator=(Stats&& other) = delete;
+
+  static std::uint64_t Now() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return static_cast<std::uint64_t>(counter.QuadPart);
+  }
+  void Add(Stage stage, std::uint64_t ticks, std::uint64_t bytes) {
+    auto& counter = counters_[static_cast<std::size_t>(stage)];
+    counter.ticks.fetch_add(ticks, std::memory_order_relaxed);
+    counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    counter.calls.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Records the download buffer holding size bytes, keeps the peak.
+  void Buffered(std::uint64_t size);
+  // Writes one line of JSON, seconds since construction included.
+  void Print(std::ostream& out) const;
+
+ private:
+  struct alignas(64) Counter {
+    std::atomic<std::uint64_t> ticks{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<std::uint64_t> calls{0};
+  };
+
+  Counter counters_[static_cast<std::size_t>(Stage::kCount)];
+  std::atomic<std::uint64_t> peak_buffered_{0};
+  std::uint64_t start_;
+};
+
+// Counts the time until it goes out of scope to a stage, and the bytes added
+// meanwhile. Without stats it costs a branch.
+class StageTimer {
+ public:
+  StageTimer(Stats* stats, Stats::Stage stage)
+      : stats_{stats}, stage_{stage}, start_{stats ? Stats::Now() : 0} {}
+  ~StageTimer() {
+    if (stats_) stats_->Add(stage_, Stats::Now() - start_, bytes_);
+  }
+  StageTimer(const StageTimer& other) = delete;
+  StageTimer(StageTimer&& other) = delete;
+  StageTimer& operator=(const StageTimer& other) = delete;
+  StageTimer& operator=(StageTimer&& other) = delete;
+
+  void Add(std::uint64_t bytes) { bytes_ += bytes; }
+
+ private:
+  Stats* stats_;
+  Stats::Stage stage_;
+  std::uint64_t start_;
+  std::uint64_t bytes_{0};
+};
\ No newline at end of file
@@ -1,14 +1,27 @@
 #pragma once
+#include <winsock2.h>
 #include <windows.h>
 
-#include <bcrypt.h>
 #include <curl/curl.h>
 #include <zlib/zlib.h>
+#include <zstd/lib/zstd.h>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <condition_variable>
 #include <cstddef>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include "bytestream.h"
\ No newline at end of file
+#include "bytestream.h"
+#include "range_source.h"
\ No newline at end of file
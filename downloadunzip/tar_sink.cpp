@@ -0,0 +1,262 @@
+#include "stdafx.h"
+
+#include "tar_sink.h"
+
+namespace {
+
+constexpr std::size_t kBlockSize = 512;
+constexpr std::size_t kBufferSize = 0x100000;     // 1 MiB
+constexpr std::size_t kMaxWriteSize = 0x4000000;  // 64 MiB
+constexpr std::uint64_t kMaxHeldSize = 0x400000;  // 4 MiB
+// 100 ns intervals from 1601 to 1970
+constexpr std::uint64_t kUnixEpoch = 116444736000000000;
+constexpr BYTE kZeros[kBlockSize]{};
+constexpr char kPaxName[] = "././@PaxHeader";
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/utilities/pax.html
+struct TarHeader {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char chksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char pad[12];
+};
+static_assert(sizeof(TarHeader) == kBlockSize, "tar header is a block");
+
+// Fills the field with octal digits and a terminating NUL, false if value
+// doesn't fit.
+template <std::size_t N>
+bool Octal(std::uint64_t value, char (&field)[N]) {
+  field[N - 1] = 0;
+  for (auto i = N - 1; i--; value >>= 3)
+    field[i] = static_cast<char>('0' + (value & 7));
+  return !value;
+}
+
+// Splits name between the name and prefix fields at a slash, false if it
+// doesn't fit either way.
+bool SetName(PCSTR name, TarHeader* header) {
+  auto size = strlen(name);
+  if (size <= sizeof(header->name)) {
+    std::memcpy(header->name, name, size);
+    return true;
+  }
+  auto slash = strchr(name + size - sizeof(header->name) - 1, '/');
+  if (!slash || !slash[1]) return false;
+  auto prefix_size = static_cast<std::size_t>(slash - name);
+  if (!prefix_size || sizeof(header->prefix) < prefix_size) return false;
+  std::memcpy(header->prefix, name, prefix_size);
+  std::memcpy(header->name, slash + 1, size - prefix_size - 1);
+  return true;
+}
+
+// Fills the rest of the header and its checksum, size is past ustar if the
+// size field is left to a pax header.
+void Seal(char typeflag, std::uint64_t size, std::uint64_t filetime,
+          TarHeader* header) {
+  Octal(typeflag == '5' ? 0755 : 0644, header->mode);
+  Octal(0, header->uid);
+  Octal(0, header->gid);
+  if (!Octal(size, header->size)) Octal(0, header->size);
+  auto mtime = kUnixEpoch < filetime ? (filetime - kUnixEpoch) / 10000000 : 0;
+  Octal(mtime, header->mtime);
+  header->typeflag = typeflag;
+  std::memcpy(header->magic, "ustar", 6);
+  std::memcpy(header->version, "00", 2);
+  // summed with the checksum field as spaces
+  std::memset(header->chksum, ' ', sizeof(header->chksum));
+  unsigned sum = 0;
+  auto bytes = reinterpret_cast<const BYTE*>(header);
+  for (std::size_t i = 0; i < sizeof(TarHeader); ++i) sum += bytes[i];
+  // six digits and a NUL, the space after them stays
+  Octal(sum, reinterpret_cast<char(&)[7]>(header->chksum));
+}
+
+// Appends a "length key=value\n" record, the length counts itself.
+void AddPaxRecord(PCSTR key, const std::string& value, std::string* records) {
+  auto size = strlen(key) + value.size() + 3;  // space, '=' and newline
+  auto digits = std::to_string(size).size();
+  if (std::to_string(size + digits).size() != digits) ++digits;
+  *records += std::to_string(size + digits) + ' ' + key + '=' + value + '\n';
+}
+
+bool WriteAll(HANDLE output, const BYTE* ptr, std::size_t size) {
+  while (size) {
+    DWORD written = 0;
+    auto chunk = static_cast<DWORD>((std::min)(size, kMaxWriteSize));
+    if (!WriteFile(output, ptr, chunk, &written, NULL)) {
+      auto error = GetLastError();
+      std::cerr << "error writing tar stream (code " << error << ')'
+                << std::endl;
+      return false;
+    }
+    ptr += written;
+    size -= written;
+  }
+  return true;
+}
+
+class TarEntrySink : public IEntrySink {
+ public:
+  explicit TarEntrySink(TarEntrySinkFactory* factory)
+      : factory_{factory}, lock_{factory->mutex(), std::defer_lock} {}
+  TarEntrySink(const TarEntrySink& other) = delete;
+  TarEntrySink(TarEntrySink&& other) = delete;
+  TarEntrySink& operator=(const TarEntrySink& other) = delete;
+  TarEntrySink& operator=(TarEntrySink&& other) = delete;
+
+  bool OnEntryBegin(const EntryInfo& entry) override {
+    name_ = entry.name;
+    size_ = entry.uncompressed_size;
+    written_ = 0;
+    held_.clear();
+    streamed_ = false;
+    if (entry.directory || size_ == EntryInfo::kUnknownSize) return true;
+    // small entries don't wait for the output
+    if (kMaxHeldSize < size_)
+      lock_.lock();
+    else if (!lock_.try_lock())
+      return true;
+    streamed_ = true;
+    return factory_->WriteHeader(entry.name, false, size_, entry.filetime);
+  }
+
+  bool Map(PBYTE* view) override {
+    *view = nullptr;
+    if (streamed_) return true;
+    // held entries of known size are decoded in place
+    held_.resize(static_cast<std::size_t>(size_));
+    *view = held_.data();
+    return true;
+  }
+
+  bool OnData(const BYTE* ptr, std::size_t size) override {
+    if (!streamed_) {
+      auto max_held = factory_->max_held();
+      if (size_ == EntryInfo::kUnknownSize && max_held &&
+          max_held - held_.size() < size) {
+        std::cerr << "entry " << name_ << " of unknown size exceeds "
+                  << max_held << " bytes held for the tar stream" << std::endl;
+        return false;
+      }
+      held_.insert(held_.end(), ptr, ptr + size);
+      return true;
+    }
+    if (size_ - written_ < size) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;  // more than the header says
+    }
+    written_ += size;
+    return factory_->Write(ptr, size);
+  }
+
+  bool OnEntryEnd(const EntryInfo& entry) override {
+    if (!streamed_) lock_.lock();
+    auto ok = streamed_ || (factory_->WriteHeader(entry.name, entry.directory,
+                                                  held_.size(),
+                                                  entry.filetime) &&
+                            factory_->Write(held_.data(), held_.size()));
+    ok = ok && factory_->Pad(streamed_ ? size_ : held_.size());
+    lock_.unlock();
+    return ok;
+  }
+
+  bool Flush() override {
+    std::lock_guard<std::mutex> lock{factory_->mutex()};
+    return factory_->Flush();
+  }
+
+ private:
+  TarEntrySinkFactory* factory_;
+  // the output, held from the header of a streamed entry to its end
+  std::unique_lock<std::mutex> lock_;
+  PCSTR name_{nullptr};    // of the entry
+  std::uint64_t size_{0};  // of the entry
+  std::uint64_t written_{0};
+  bool streamed_{false};   // written as it comes, not held
+  std::vector<BYTE> held_;
+};
+
+}  // namespace
+
+void TarEntrySinkFactory::Initialize(HANDLE output, std::uint64_t max_held) {
+  output_ = output;
+  max_held_ = max_held;
+  buffer_.reset(new BYTE[kBufferSize]);
+}
+
+std::unique_ptr<IEntrySink> TarEntrySinkFactory::Create() {
+  return std::make_unique<TarEntrySink>(this);
+}
+
+bool TarEntrySinkFactory::Finish() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  // two zero blocks end the archive
+  return Write(kZeros, kBlockSize) && Write(kZeros, kBlockSize) && Flush();
+}
+
+bool TarEntrySinkFactory::WriteHeader(PCSTR name, bool directory,
+                                      std::uint64_t size,
+                                      std::uint64_t filetime) {
+  TarHeader header{};
+  std::string records;
+  if (!SetName(name, &header)) {
+    AddPaxRecord("path", name, &records);
+    std::memcpy(header.name, name, sizeof(header.name));
+  }
+  if (!Octal(size, header.size))
+    AddPaxRecord("size", std::to_string(size), &records);
+  if (!records.empty()) {
+    TarHeader pax{};
+    std::memcpy(pax.name, kPaxName, sizeof(kPaxName));
+    Seal('x', records.size(), filetime, &pax);
+    auto ok = Write(reinterpret_cast<const BYTE*>(&pax), sizeof(pax)) &&
+              Write(reinterpret_cast<const BYTE*>(records.data()),
+                    records.size()) &&
+              Pad(records.size());
+    if (!ok) return false;
+  }
+  Seal(directory ? '5' : '0', size, filetime, &header);
+  return Write(reinterpret_cast<const BYTE*>(&header), sizeof(header));
+}
+
+bool TarEntrySinkFactory::Write(const BYTE* ptr, std::size_t size) {
+  if (failed_) return false;
+  if (kBufferSize - buffer_size_ < size && !Flush()) return false;
+  if (size < kBufferSize) {
+    if (size) std::memcpy(buffer_.get() + buffer_size_, ptr, size);
+    buffer_size_ += size;
+    return true;
+  }
+  // large writes skip the buffer
+  if (WriteAll(output_, ptr, size)) return true;
+  failed_ = true;
+  return false;
+}
+
+bool TarEntrySinkFactory::Pad(std::uint64_t size) {
+  auto padding = static_cast<std::size_t>((kBlockSize - size % kBlockSize) %
+                                          kBlockSize);
+  return Write(kZeros, padding);
+}
+
+bool TarEntrySinkFactory::Flush() {
+  if (failed_) return false;
+  auto size = buffer_size_;
+  buffer_size_ = 0;
+  if (WriteAll(output_, buffer_.get(), size)) return true;
+  failed_ = true;
+  return false;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+#include "entry_sink.h"
+
+// Writes entries to a handle as one ustar stream, with pax headers for names
+// and sizes ustar can't hold. Entries are written whole, one at a time: a
+// sink streams its entry while it has the output, while another sink has it
+// entries up to 4 MiB are held in memory instead, larger ones wait. Entries
+// of unknown size are held in memory whole, up to a limit.
+class TarEntrySinkFactory : public IEntrySinkFactory {
+ public:
+  TarEntrySinkFactory() = default;
+  TarEntrySinkFactory(const TarEntrySinkFactory& other) = delete;
+  TarEntrySinkFactory(TarEntrySinkFactory&& other) = delete;
+  TarEntrySinkFactory& operator=(const TarEntrySinkFactory& other) = delete;
+  TarEntrySinkFactory& operator=(TarEntrySinkFactory&& other) = delete;
+
+  // output is written to, not owned. Entries of unknown size larger than
+  // max_held fail, 0 means no limit.
+  void Initialize(HANDLE output, std::uint64_t max_held);
+  std::unique_ptr<IEntrySink> Create() override;
+  // Ends the stream once all entries are written.
+  bool Finish();
+
+  std::uint64_t max_held() const { return max_held_; }
+  // Used by the sinks with mutex() held.
+  std::mutex& mutex() { return mutex_; }
+  bool WriteHeader(PCSTR name, bool directory, std::uint64_t size,
+                   std::uint64_t filetime);
+  bool Write(const BYTE* ptr, std::size_t size);
+  // Pads the data of an entry of size to a whole block.
+  bool Pad(std::uint64_t size);
+  bool Flush();
+
+ private:
+  std::mutex mutex_;
+  HANDLE output_{INVALID_HANDLE_VALUE};
+  std::uint64_t max_held_{0};
+  std::unique_ptr<BYTE[]> buffer_;
+  std::size_t buffer_size_{0};
+  bool failed_{false};
+};
\ No newline at end of file
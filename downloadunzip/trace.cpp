@@ -0,0 +1,95 @@
+#include "stdafx.h"
+
+#include "trace.h"
+
+namespace {
+
+std::atomic<unsigned> NextTraceId{1};
+
+// Appends s as the contents of a JSON string.
+void AppendEscaped(const std::string& s, std::string* text) {
+  for (auto ch : s) {
+    if (ch == '"' || ch == '\\') {
+      *text += '\\';
+      *text += ch;
+    } else if (0 <= ch && ch < 0x20) {
+      constexpr char kHex[] = "0123456789abcdef";
+      *text += "\\u00";
+      *text += kHex[ch >> 4];
+      *text += kHex[ch & 0xf];
+    } else
+      *text += ch;
+  }
+}
+
+}  // namespace
+
+Trace::Trace() : id_{NextTraceId++}, start_{Stats::Now()} {}
+
+void Trace::Add(PCSTR name, std::uint64_t start, PCSTR detail) {
+  auto end = Stats::Now();
+  ThreadBuffer()->events.push_back(
+      Event{name, start, end, detail ? detail : std::string{}});
+}
+
+Trace::Buffer* Trace::ThreadBuffer() {
+  struct Cached {
+    unsigned id;
+    Buffer* buffer;
+  };
+  thread_local Cached cached{0, nullptr};
+  if (cached.id == id_) return cached.buffer;
+  std::lock_guard<std::mutex> lock{mutex_};
+  buffers_.push_back(std::make_unique<Buffer>());
+  auto buffer = buffers_.back().get();
+  buffer->thread = static_cast<unsigned>(buffers_.size());
+  cached = Cached{id_, buffer};
+  return buffer;
+}
+
+bool Trace::Save(PCSTR path) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  auto us = [&frequency](std::uint64_t ticks) {
+    return std::to_string(static_cast<double>(ticks) * 1000000 /
+                          static_cast<double>(frequency.QuadPart));
+  };
+  std::string text = "{\"traceEvents\":[";
+  auto first = true;
+  for (auto& buffer : buffers_) {
+    for (auto& event : buffer->events) {
+      text += first ? "\n" : ",\n";
+      first = false;
+      text += "{\"name\":\"";
+      text += event.name;
+      text += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+      text += std::to_string(buffer->thread);
+      text += ",\"ts\":";
+      text += us(event.start - start_);
+      text += ",\"dur\":";
+      text += us(event.end - event.start);
+      if (!event.detail.empty()) {
+        text += ",\"args\":{\"name\":\"";
+        AppendEscaped(event.detail, &text);
+        text += "\"}";
+      }
+      text += '}';
+    }
+  }
+  text += "\n],\"displayTimeUnit\":\"ms\"}\n";
+  auto file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                          FILE_ATTRIBUTE_NORMAL, NULL);
+  auto ok = file != INVALID_HANDLE_VALUE;
+  if (ok) {
+    DWORD written = 0;
+    ok = WriteFile(file, text.data(), static_cast<DWORD>(text.size()),
+                   &written, NULL) &&
+         written == text.size();
+    CloseHandle(file);
+  }
+  if (ok) return true;
+  std::cerr << "error writing trace file " << path << " (code "
+            << GetLastError() << ')' << std::endl;
+  return false;
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+#include "stats.h"  // Stats::Now
+
+// Records timed spans from any thread and saves them as Chrome trace-event
+// JSON, see https://ui.perfetto.dev. Each thread appends to a buffer of its
+// own, only its first span takes a lock.
+class Trace {
+ public:
+  Trace();
+  Trace(const Trace& other) = delete;
+  Trace(Trace&& other) = delete;
+  Trace& operator=(const Trace& other) = delete;
+  Trace& operator=(Trace&& other) = delete;
+
+  // Records a span of the calling thread from start to now. name outlives
+  // the trace, detail is copied, nullptr if none.
+  void Add(PCSTR name, std::uint64_t start, PCSTR detail);
+  // Writes the spans once the threads that record them are done.
+  bool Save(PCSTR path);
+
+ private:
+  struct Event {
+    PCSTR name;
+    std::uint64_t start;
+    std::uint64_t end;
+    std::string detail;
+  };
+  struct Buffer {
+    unsigned thread;
+    std::deque<Event> events;  // no moves as it grows
+  };
+
+  Buffer* ThreadBuffer();
+
+  unsigned id_;  // tells traces apart in the buffers cached per thread
+  std::uint64_t start_;
+  std::mutex mutex_;  // guards buffers_
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+// Records a span from construction until it goes out of scope. Without a
+// trace it costs a branch.
+class TraceSpan {
+ public:
+  TraceSpan(Trace* trace, PCSTR name, PCSTR detail = nullptr)
+      : trace_{trace},
+        name_{name},
+        detail_{detail},
+        start_{trace ? Stats::Now() : 0} {}
+  ~TraceSpan() {
+    if (trace_) trace_->Add(name_, start_, detail_);
+  }
+  TraceSpan(const TraceSpan& other) = delete;
+  TraceSpan(TraceSpan&& other) = delete;
+  TraceSpan& operator=(const TraceSpan& other) = delete;
+  TraceSpan& operator=(TraceSpan&& other) = delete;
+
+ private:
+  Trace* trace_;
+  PCSTR name_;
+  PCSTR detail_;  // outlives the span
+  std::uint64_t start_;
+};
\ No newline at end of file
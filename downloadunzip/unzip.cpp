@@ -1,154 +1,200 @@
 #include "stdafx.h"
-// https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+
 #include "unzip.h"
 
+#include "crc32.h"
+#include "digest_list.h"
+#include "entry_filter.h"
+#include "memory_bytestream.h"
+#include "sha256.h"
+#include "stats.h"
+#include "trace.h"
+#include "update_index.h"
+#include "zip_format.h"
+
 namespace {
 
-// Local file header
-#pragma pack(2)
-struct alignas(2) LocalFileHeader {
-  static constexpr std::uint32_t kSignature = 0x04034b50;
-  std::uint16_t version_needed_to_extract;
-  std::uint16_t general_purpose_bit_flag;
-  std::uint16_t compression_method;
-  std::uint16_t last_mod_file_time;
-  std::uint16_t last_mod_file_date;
-  std::uint32_t crc32;
-  std::uint32_t compressed_size;
-  std::uint32_t uncompressed_size;
-  std::uint16_t file_name_length;
-  std::uint16_t extra_field_length;
-  // (variable size) file name
-  // (variable size) extra field
-};
+constexpr std::size_t kFileNameSize = MAX_PATH;
+constexpr std::size_t kChunkSize = 0x4000;         // 16 KiB
+constexpr std::size_t kMaxJobSize = 0x1000000;     // 16 MiB
+constexpr std::size_t kMaxQueuedSize = 0x4000000;  // 64 MiB
+constexpr std::size_t kRangeSize = 0x100000;       // 1 MiB
+// largest entry inflated with one call, fits an address space and the 32-bit
+// counts of zlib on any platform
+constexpr std::size_t kMaxWholeSize = 0x40000000;  // 1 GiB
+// files --update records at most before their sink is flushed
+constexpr std::size_t kMaxUnflushedFiles = 0x1000;
+// the value is in the ZIP64 extended information
+constexpr std::uint32_t kZip64Field = 0xFFFFFFFF;
+
+class ProgressTracker;
 
-// Central directory header
-#pragma pack(2)
-struct alignas(2) CentralDirectoryHeader {
-  static constexpr std::uint32_t kSignature = 0x02014b50;
-  std::uint16_t version_made_by;
-  std::uint16_t version_needed_to_extract;
-  std::uint16_t general_purpose_bit_flag;
-  std::uint16_t compression_method;
-  std::uint16_t last_mod_file_time;
-  std::uint16_t last_mod_file_date;
+// Entry located by the central directory
+struct ArchiveEntry {
+  std::uint64_t offset;  // of the local file header
+  std::uint64_t size;    // up to the next entry or the central directory
+  std::uint64_t compressed_size;
+  std::uint64_t uncompressed_size;
   std::uint32_t crc32;
-  std::uint32_t compressed_size;
-  std::uint32_t uncompressed_size;
-  std::uint16_t file_name_length;
-  std::uint16_t extra_field_length;
-  std::uint16_t file_comment_length;
-  std::uint16_t disk_number_start;
-  std::uint16_t internal_file_attributes;
-  std::uint32_t external_file_attributes;
-  std::uint32_t relative_offset_of_local_header;
-  // (variable size) file name
-  // (variable size) extra field
-  // (variable size) file comment
+  bool selected;
 };
 
-// End of central directory record
-#pragma pack(2)
-struct alignas(2) EndOfCentralDirectoryRecord {
-  static constexpr std::uint32_t kSignature = 0x06054b50;
-  std::uint16_t number_of_this_disk;
-  std::uint16_t number_of_the_disk_with_the_start_of_the_central_directory;
-  std::uint16_t total_number_of_entries_in_the_central_directory_on_this_disk;
-  std::uint16_t total_number_of_entries_in_the_central_directory;
-  std::uint32_t size_of_the_central_directory;
-  std::uint32_t
-      offset_of_start_of_central_directory_with_respect_to_the_starting_disk_number;
-  std::uint16_t zip_file_comment_length;
-  // (variable size) zip_file_comment;
+// A file written for --update, to index once it's on disk.
+struct WrittenFile {
+  std::string path;
+  std::uint64_t size;
+  std::uint32_t crc;
+  std::uint64_t filetime;
 };
 
-constexpr std::size_t kFileNameSize = MAX_PATH;
-constexpr std::size_t kChunkSize = 0x4000;  // 16 KiB
-
 struct UnzipContext {
   UnzipContext(IBytestream* stream, UnzipOptions* options)
-      : stream{stream}, options{options}, filename{}, in{}, out{} {}
+      : stream{stream},
+        options{options},
+        offset{options->offset},
+        entry_offset{0},
+        compressed_size{0},
+        uncompressed_size{0},
+        zip64{false},
+        progress{nullptr},
+        filename{},
+        name{filename},
+        out{},
+        view{nullptr},
+        view_end{nullptr},
+        data_size{0},
+        discard{false},
+        central{nullptr},
+        inflater{CreateInflateEngine(options->inflate)},
+        packed_size{0},
+        unpacked_size{0},
+        zstd{nullptr, ZSTD_freeDCtx},
+        sink{options->sinks->Create()},
+        entry{} {
+    if (!options->directory) return;
+    // too long a directory leaves no room for entry names
+    auto size = strnlen(options->directory, kFileNameSize - 1);
+    std::memcpy(filename, options->directory, size);
+    name += size;
+  }
 
   IBytestream* stream;
   UnzipOptions* options;
+  std::uint64_t offset;  // of the stream position in the archive
+  std::uint64_t entry_offset;  // of the local file header being read
+  // of the entry, from the ZIP64 extended information if the header ones
+  // don't fit, from the data descriptor once it's read if bit 3 is set
+  std::uint64_t compressed_size;
+  std::uint64_t uncompressed_size;
+  bool zip64;  // the entry has ZIP64 extended information
+  std::vector<BYTE> extra;  // field of the header being read
+  ProgressTracker* progress;
   char filename[kFileNameSize];
-  TBYTE in[kChunkSize];
+  PSTR name;  // of the entry, past the destination directory in filename
   TBYTE out[kChunkSize];
+  // next byte of the buffer the sink maps and its end, nullptr if the entry
+  // is passed to the sink in pieces
+  PBYTE view;
+  PBYTE view_end;
+  std::uint64_t data_size;  // uncompressed, of the entry read so far
+  bool discard;  // the entry is skipped, its data is read only to get past it
+  // descriptors of the entries they delimit, by local file header offset, to
+  // check against the central directory, sizes are 8 bytes either way
+  std::unordered_map<std::uint64_t, Zip64DataDescriptor> descriptors;
+  // entries by offset if the central directory was read first, nullptr
+  // otherwise, they are checked against it as they are read then
+  const std::vector<ArchiveEntry>* central;
+  // whole entry inflate, nullptr if entries are streamed
+  std::unique_ptr<IInflateEngine> inflater;
+  // whole entry buffers, allocated by the first entry that needs them and
+  // grown by larger ones, not zeroed
+  std::unique_ptr<BYTE[]> packed;  // entries split in the stream buffer
+  std::size_t packed_size;
+  std::unique_ptr<BYTE[]> unpacked;
+  std::size_t unpacked_size;
+  // Zstandard decoder, created by the first entry that needs it and reused
+  std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> zstd;
+  SHA256 sha256;  // of the entry being extracted, with digests only
+  std::unique_ptr<IEntrySink> sink;
+  EntryInfo entry;  // being extracted
+  // closed by the sink, which might still be writing them
+  std::vector<WrittenFile> written;
 };
 
 bool Read(PVOID ptr, std::size_t size, UnzipContext* ctx) {
-  return Read(ctx->stream, ptr, size);
+  if (!Read(ctx->stream, ptr, size)) return false;
+  ctx->offset += size;
+  return true;
 }
 
-bool Read(std::size_t size, UnzipContext* ctx) {
-  assert(size <= kChunkSize);
-  return Read(ctx->in, size, ctx);
+bool Peek(PBYTE* ptr, std::size_t* size, UnzipContext* ctx) {
+  return ctx->stream->Peek(ptr, size);
 }
 
-bool Read(std::size_t size, UnzipContext* ctx, std::size_t* read) {
-  size = (std::min)(size, kChunkSize);
-  return ctx->stream->Read(ctx->in, size, read);
+void Consume(std::size_t size, UnzipContext* ctx) {
+  ctx->stream->Consume(size);
+  ctx->offset += size;
 }
 
-bool Skip(std::size_t size, UnzipContext* ctx) {
-  return Skip(ctx->stream, size);
+bool Skip(std::uint64_t size, UnzipContext* ctx) {
+  if (!Skip(ctx->stream, size)) return false;
+  ctx->offset += size;
+  return true;
 }
 
-bool Write(PVOID ptr, std::size_t size, UnzipContext* ctx, HANDLE dst) {
-  if (ctx->options->dryrun) return true;
-  DWORD written = 0;
-  if (WriteFile(dst, ptr, size, &written, NULL)) return true;
-  auto error = GetLastError();
-  std::cerr << "error writing file " << ctx->filename << " (code " << error
-            << ')' << std::endl;
-  return false;
+// Checksums data right after it's produced, while it's still in cache.
+void Checksum(PBYTE ptr, std::size_t size, UnzipContext* ctx, uLong* crc) {
+  auto stats = ctx->options->stats;
+  {
+    StageTimer timer{stats, Stats::Stage::kCrc32};
+    *crc = Crc32(static_cast<std::uint32_t>(*crc), ptr, size);
+    timer.Add(size);
+  }
+  ctx->data_size += size;
+  if (!ctx->options->digests || ctx->discard) return;
+  StageTimer timer{stats, Stats::Stage::kSha256};
+  ctx->sha256.Hash(ptr, size);
+  timer.Add(size);
 }
 
-bool Write(std::size_t size, UnzipContext* ctx, HANDLE dst) {
-  assert(size <= kChunkSize);
-  return Write(ctx->out, size, ctx, dst);
+bool Write(PBYTE ptr, std::size_t size, UnzipContext* ctx, uLong* crc) {
+  Checksum(ptr, size, ctx, crc);
+  if (ctx->discard) return true;
+  if (!ctx->view) {
+    StageTimer timer{ctx->options->stats, Stats::Stage::kWrite};
+    timer.Add(size);
+    return ctx->sink->OnData(ptr, size);
+  }
+  assert(size <= static_cast<std::size_t>(ctx->view_end - ctx->view));
+  std::memcpy(ctx->view, ptr, size);
+  ctx->view += size;
+  return true;
 }
 
-HANDLE OpenFileForWriting(UnzipContext* ctx) {
-  auto path = ctx->filename;
-  auto options = ctx->options;
-  DWORD creation_disposition = options->overwrite ? CREATE_ALWAYS : CREATE_NEW;
-  auto file = ::CreateFileA(path, GENERIC_WRITE, 0, NULL, creation_disposition,
-                            FILE_ATTRIBUTE_NORMAL, NULL);
-  if (file != INVALID_HANDLE_VALUE) return file;
-  auto error = GetLastError();
-  if (error != ERROR_PATH_NOT_FOUND) {
-    std::cerr << "error creating file " << path << " (code " << error << ')'
-              << std::endl;
-    return nullptr;
-  }
-  // create directory
-  for (int i = 0; path[i]; ++i) {
-    for (; path[i] && path[i] != '/' && path[i] != '\\'; ++i)
-      ;
-    if (!path[i]) break;
-    auto ch = path[i];
-    path[i] = 0;
-    auto succeeded = CreateDirectory(path, NULL);
-    error = GetLastError();
-    path[i] = ch;
-    if (!succeeded && error != ERROR_ALREADY_EXISTS) {
-      error = GetLastError();
-      std::cerr << "error creating directory" << path << " (code " << error
-                << ')' << std::endl;
-      return nullptr;
-    }
+// Where a decoder writes next. Mapped entries are decoded into, a window at a
+// time so that it's checksummed while in cache.
+PBYTE Output(std::size_t* size, UnzipContext* ctx) {
+  *size = kChunkSize;
+  if (!ctx->view || ctx->view == ctx->view_end) return ctx->out;
+  *size = (std::min)(*size,
+                     static_cast<std::size_t>(ctx->view_end - ctx->view));
+  return ctx->view;
+}
+
+// Takes size bytes a decoder wrote to out, as returned by Output().
+bool Decoded(PBYTE out, std::size_t size, UnzipContext* ctx, uLong* crc) {
+  if (out == ctx->view) {
+    Checksum(out, size, ctx, crc);
+    ctx->view += size;
+    return true;
   }
-  file = ::CreateFileA(path, GENERIC_WRITE, 0, NULL, creation_disposition,
-                       FILE_ATTRIBUTE_NORMAL, NULL);
-  if (file != INVALID_HANDLE_VALUE) return file;
-  error = GetLastError();
-  std::cerr << "error creating file " << path << " (code " << error << ')'
-            << std::endl;
-  return nullptr;
+  if (!ctx->view || !size) return Write(out, size, ctx, crc);
+  std::cerr << "unsupported or invalid zip file format" << std::endl;
+  return false;  // more than the mapped size
 }
 
-bool Inflate(std::uint32_t size, UnzipContext* ctx, HANDLE dst, uLong* crc) {
+// size bounds the compressed data, the deflate stream marks its end.
+bool Inflate(std::uint64_t size, UnzipContext* ctx, uLong* crc) {
   // https://zlib.net/zpipe.c
   z_stream strm{};
   auto res = inflateInit2(&strm, -MAX_WBITS);
@@ -159,17 +205,26 @@ bool Inflate(std::uint32_t size, UnzipContext* ctx, HANDLE dst, uLong* crc) {
   using z_stream_guard = std::unique_ptr<z_stream, decltype(&inflateEnd)>;
   auto guard = z_stream_guard{&strm, inflateEnd};
   do {  // until deflate stream ends or end of file
-    std::size_t read = min(size, kChunkSize);
-    if (!Read(read, ctx)) return false;
-    size -= read;
-    strm.avail_in = read;
-    if (strm.avail_in == 0) break;
-    strm.next_in = ctx->in;
+    // inflate straight from the stream buffer
+    PBYTE in = nullptr;
+    std::size_t avail = 0;
+    if (!Peek(&in, &avail, ctx)) return false;
+    if (size < avail) avail = static_cast<std::size_t>(size);
+    avail = (std::min)(avail, static_cast<std::size_t>(UINT_MAX));
+    if (avail == 0) return false;
+    strm.avail_in = static_cast<uInt>(avail);
+    strm.next_in = in;
     // run inflate() on input until output buffer not full
     do {
-      strm.avail_out = kChunkSize;
-      strm.next_out = ctx->out;
-      res = inflate(&strm, Z_NO_FLUSH);
+      std::size_t out_size = 0;
+      auto out = Output(&out_size, ctx);
+      strm.avail_out = static_cast<uInt>(out_size);
+      strm.next_out = out;
+      {
+        StageTimer timer{ctx->options->stats, Stats::Stage::kInflate};
+        res = inflate(&strm, Z_NO_FLUSH);
+        timer.Add(out_size - strm.avail_out);
+      }
       assert(res != Z_STREAM_ERROR);  // state not clobbered
       switch (res) {
         case Z_NEED_DICT:
@@ -179,138 +234,1135 @@ bool Inflate(std::uint32_t size, UnzipContext* ctx, HANDLE dst, uLong* crc) {
           std::cerr << "zlib error (code " << res << ')' << std::endl;
           return false;
       }
-      auto inflated = kChunkSize - strm.avail_out;
-      if (!Write(inflated, ctx, dst)) return false;
-      *crc = crc32(*crc, ctx->out, inflated);
+      if (!Decoded(out, out_size - strm.avail_out, ctx, crc)) return false;
     } while (strm.avail_out == 0);
+    avail -= strm.avail_in;
+    Consume(avail, ctx);
+    size -= avail;
   } while (res != Z_STREAM_END && size);
   return res == Z_STREAM_END;
 }
 
-bool Unzip(LocalFileHeader* header, UnzipContext* ctx) {
-  if (!header->file_name_length) {
-    std::cerr << "unsupported or invalid zip file format" << std::endl;
-    return false;
+// size bounds the compressed data, UINT64_MAX if it's unknown. Known size
+// data may hold several Zstandard frames, otherwise the first one ends it.
+bool Unzstd(std::uint64_t size, UnzipContext* ctx, uLong* crc) {
+  if (!ctx->zstd) {
+    ctx->zstd.reset(ZSTD_createDCtx());
+    if (!ctx->zstd) {
+      std::cerr << "error initializing zstd" << std::endl;
+      return false;
+    }
   }
-  // read file name
-  if (kFileNameSize - 1 < header->file_name_length) {
-    std::cerr << "file name length exceeds " << kFileNameSize - 1
-              << " characters" << std::endl;
-    return false;
+  auto dctx = ctx->zstd.get();
+  // a failed entry may leave a frame half decoded
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  auto bounded = size != UINT64_MAX;
+  auto ended = false;
+  do {  // until the data or its first frame ends
+    // decode straight from the stream buffer
+    PBYTE in = nullptr;
+    std::size_t avail = 0;
+    if (!Peek(&in, &avail, ctx)) return false;
+    if (size < avail) avail = static_cast<std::size_t>(size);
+    if (avail == 0) return false;
+    ZSTD_inBuffer input{in, avail, 0};
+    for (;;) {
+      std::size_t out_size = 0;
+      auto out = Output(&out_size, ctx);
+      ZSTD_outBuffer output{out, out_size, 0};
+      std::size_t res = 0;
+      {
+        StageTimer timer{ctx->options->stats, Stats::Stage::kUnzstd};
+        res = ZSTD_decompressStream(dctx, &output, &input);
+        timer.Add(output.pos);
+      }
+      if (ZSTD_isError(res)) {
+        std::cerr << "zstd error (" << ZSTD_getErrorName(res) << ')'
+                  << std::endl;
+        return false;
+      }
+      if (!Decoded(out, output.pos, ctx, crc)) return false;
+      // 0 once a frame is decoded and flushed
+      ended = res == 0;
+      if (ended && !bounded) break;
+      // a full output buffer may leave more to flush, unless the frame ended
+      if (input.pos == input.size && (ended || output.pos < out_size)) break;
+    }
+    Consume(input.pos, ctx);
+    size -= input.pos;
+  } while (size && !(ended && !bounded));
+  return ended;
+}
+
+// Makes buffer hold at least size bytes, dropping its contents.
+PBYTE Reserve(std::unique_ptr<BYTE[]>* buffer, std::size_t* buffer_size,
+              std::size_t size) {
+  if (*buffer_size < size) {
+    buffer->reset();  // the old one goes first
+    buffer->reset(new BYTE[size]);
+    *buffer_size = size;
   }
-  auto filename = ctx->filename;
-  auto options = ctx->options;
-  auto ok = Read(filename, header->file_name_length, ctx) &&
-            Skip(header->extra_field_length, ctx);
-  if (!ok) {
-    std::cerr << "unsupported or invalid zip file format" << std::endl;
-    return false;
+  return buffer->get();
+}
+
+// Inflates an entry that fits the whole entry buffers with one call.
+bool InflateBuffer(UnzipContext* ctx, uLong* crc) {
+  auto size = static_cast<std::size_t>(ctx->compressed_size);
+  PBYTE in = nullptr;
+  std::size_t avail = 0;
+  if (!Peek(&in, &avail, ctx)) return false;
+  // inflate straight from the stream buffer if it holds the whole entry
+  auto split = avail < size;
+  if (split) {
+    in = Reserve(&ctx->packed, &ctx->packed_size, size);
+    if (!Read(in, size, ctx)) return false;
   }
-  filename[header->file_name_length] = 0;
-  // create file or directory
-  auto ch = filename[header->file_name_length - 1];
-  if (ch == '/' || ch == '\\') {
-    if (header->compressed_size || header->uncompressed_size) {
+  auto out_size = static_cast<std::size_t>(ctx->uncompressed_size);
+  auto out = ctx->view ? ctx->view
+                       : Reserve(&ctx->unpacked, &ctx->unpacked_size, out_size);
+  {
+    StageTimer timer{ctx->options->stats, Stats::Stage::kInflate};
+    if (!ctx->inflater->Inflate(in, size, out, out_size)) return false;
+    timer.Add(out_size);
+  }
+  if (!split) Consume(size, ctx);
+  if (!ctx->view) return Write(out, out_size, ctx, crc);
+  Checksum(out, out_size, ctx, crc);
+  ctx->view += out_size;
+  return true;
+}
+
+// Data descriptor sizes are 8 bytes with ZIP64 extended information.
+std::size_t DataDescriptorSize(bool zip64) {
+  return zip64 ? sizeof(Zip64DataDescriptor) : sizeof(DataDescriptor);
+}
+
+// Reads a data descriptor past its signature, sizes widened to 8 bytes.
+void ParseDataDescriptor(const BYTE* ptr, bool zip64,
+                         Zip64DataDescriptor* descriptor) {
+  if (zip64) {
+    std::memcpy(descriptor, ptr, sizeof(Zip64DataDescriptor));
+    return;
+  }
+  DataDescriptor narrow{};
+  std::memcpy(&narrow, ptr, sizeof(DataDescriptor));
+  descriptor->crc32 = narrow.crc32;
+  descriptor->compressed_size = narrow.compressed_size;
+  descriptor->uncompressed_size = narrow.uncompressed_size;
+}
+
+// True if the sizes are what a descriptor of that width can hold.
+bool SizeMatches(std::uint64_t field, std::uint64_t size, bool zip64) {
+  return field == (zip64 ? size : static_cast<std::uint32_t>(size));
+}
+
+// True if ptr holds the data descriptor of stored data: size bytes with the
+// crc, followed by data_size bytes at data. Their crc is computed only once
+// the signature and sizes match.
+bool IsDataDescriptor(const BYTE* ptr, std::uint64_t size, uLong crc,
+                      const BYTE* data, std::size_t data_size, bool zip64,
+                      Zip64DataDescriptor* descriptor) {
+  std::uint32_t signature = 0;
+  std::memcpy(&signature, ptr, sizeof(std::uint32_t));
+  if (signature != DataDescriptor::kSignature) return false;
+  ParseDataDescriptor(ptr + sizeof(std::uint32_t), zip64, descriptor);
+  size += data_size;
+  if (!SizeMatches(descriptor->compressed_size, size, zip64) ||
+      !SizeMatches(descriptor->uncompressed_size, size, zip64))
+    return false;
+  if (data_size) crc = Crc32(static_cast<std::uint32_t>(crc), data, data_size);
+  return descriptor->crc32 == crc;
+}
+
+// Copies stored data of unknown size. Its end is the first data descriptor
+// signature followed by the crc and sizes of the data before it.
+bool CopyToDataDescriptor(Zip64DataDescriptor* descriptor, UnzipContext* ctx,
+                          uLong* crc) {
+  auto zip64 = ctx->zip64;
+  auto size = sizeof(std::uint32_t) + DataDescriptorSize(zip64);
+  constexpr BYTE kFirstByte = DataDescriptor::kSignature & 0xff;
+  // read past the end of the stream buffer, not copied yet
+  BYTE window[sizeof(std::uint32_t) + sizeof(Zip64DataDescriptor)];
+  std::size_t window_size = 0;
+  for (;;) {
+    if (window_size) {
+      if (!Read(window + window_size, size - window_size, ctx)) return false;
+      window_size = size;
+      if (IsDataDescriptor(window, ctx->data_size, *crc, nullptr, 0, zip64,
+                           descriptor))
+        return true;
+      // another signature may start within the window
+      std::size_t next =
+          std::find(window + 1, window + size, kFirstByte) - window;
+      if (!Write(window, next, ctx, crc)) return false;
+      window_size -= next;
+      std::memmove(window, window + next, window_size);
+      continue;
+    }
+    PBYTE in = nullptr;
+    std::size_t avail = 0;
+    if (!Peek(&in, &avail, ctx)) return false;
+    if (!avail) {
       std::cerr << "unsupported or invalid zip file format" << std::endl;
       return false;
     }
-    if (options->dryrun) return true;
-    auto ok = CreateDirectoryA(filename, NULL);
-    auto error = GetLastError();
-    if (ok || error == ERROR_ALREADY_EXISTS) return true;
-    std::cerr << "error creating directory " << filename << " (code " << error
-              << ')' << std::endl;
+    // check the signatures that fit the stream buffer in place
+    std::size_t end = avail < size ? 0 : avail - size + 1;
+    for (auto ptr = std::find(in, in + end, kFirstByte); ptr != in + end;
+         ptr = std::find(ptr + 1, in + end, kFirstByte)) {
+      std::size_t i = ptr - in;
+      if (!IsDataDescriptor(in + i, ctx->data_size, *crc, in, i, zip64,
+                            descriptor))
+        continue;
+      if (!Write(in, i, ctx, crc)) return false;
+      Consume(i + size, ctx);
+      return true;
+    }
+    if (!Write(in, end, ctx, crc)) return false;
+    Consume(end, ctx);
+    // the rest is too short to tell, it's checked across buffers
+    window_size = avail - end;
+    if (!Read(window, window_size, ctx)) return false;
+  }
+}
+
+// Reads the data descriptor following deflated data, compressed_size and
+// ctx->data_size are what the data took.
+bool ReadDataDescriptor(std::uint64_t compressed_size,
+                        Zip64DataDescriptor* descriptor, UnzipContext* ctx) {
+  auto zip64 = ctx->zip64;
+  auto size = DataDescriptorSize(zip64);
+  BYTE data[sizeof(Zip64DataDescriptor)];
+  std::uint32_t signature = 0;
+  if (!Read(&signature, sizeof(std::uint32_t), ctx)) return false;
+  auto ok = false;
+  if (signature == DataDescriptor::kSignature) {
+    ok = Read(data, size, ctx);
+  } else {
+    // no signature, it was the crc
+    std::memcpy(data, &signature, sizeof(std::uint32_t));
+    ok = Read(data + sizeof(std::uint32_t), size - sizeof(std::uint32_t), ctx);
+  }
+  if (!ok) return false;
+  ParseDataDescriptor(data, zip64, descriptor);
+  if (SizeMatches(descriptor->compressed_size, compressed_size, zip64) &&
+      SizeMatches(descriptor->uncompressed_size, ctx->data_size, zip64))
+    return true;
+  std::cerr << "data descriptor does not match for " << ctx->filename
+            << std::endl;
+  return false;
+}
+
+bool ReadFileName(LocalFileHeader* header, UnzipContext* ctx) {
+  if (!header->file_name_length) {
+    std::cerr << "unsupported or invalid zip file format" << std::endl;
     return false;
   }
-  if (!header->compressed_size && header->uncompressed_size) {
+  std::size_t max_size = kFileNameSize - 1 - (ctx->name - ctx->filename);
+  if (max_size < header->file_name_length) {
+    std::cerr << "file name length exceeds " << max_size << " characters"
+              << std::endl;
+    return false;
+  }
+  if (!Read(ctx->name, header->file_name_length, ctx)) {
     std::cerr << "unsupported or invalid zip file format" << std::endl;
     return false;
   }
-  using file_t = std::unique_ptr<void, decltype(&CloseHandle)>;
-  auto file = file_t{nullptr, CloseHandle};
-  if (!options->dryrun) {
-    file.reset(OpenFileForWriting(ctx));
-    if (!file) return false;
+  ctx->name[header->file_name_length] = 0;
+  return true;
+}
+
+// Finds the ZIP64 extended information among the blocks of an extra field.
+bool FindZip64ExtraField(const BYTE* extra, std::size_t extra_size,
+                         const BYTE** ptr, std::size_t* size) {
+  constexpr auto kBlockHeaderSize = sizeof(ExtraFieldHeader);
+  ExtraFieldHeader block{};
+  for (std::size_t i = 0; i + kBlockHeaderSize <= extra_size;
+       i += kBlockHeaderSize + block.size) {
+    std::memcpy(&block, extra + i, kBlockHeaderSize);
+    if (block.tag != ExtraFieldHeader::kZip64Tag) continue;
+    *ptr = extra + i + kBlockHeaderSize;
+    *size = (std::min)(static_cast<std::size_t>(block.size),
+                       extra_size - i - kBlockHeaderSize);
+    return true;
   }
-  if (!header->compressed_size) return true;
-  // read file contents
-  uLong crc = 0;
+  *ptr = nullptr;
+  *size = 0;
+  return false;
+}
+
+// Takes the value of a header field, from the next 8 bytes of the ZIP64
+// extended information if the field is all ones.
+bool Widen(std::uint32_t field, const BYTE** ptr, std::size_t* size,
+           std::uint64_t* value) {
+  *value = field;
+  if (field != kZip64Field) return true;
+  if (*size < sizeof(std::uint64_t)) return false;
+  std::memcpy(value, *ptr, sizeof(std::uint64_t));
+  *ptr += sizeof(std::uint64_t);
+  *size -= sizeof(std::uint64_t);
+  return true;
+}
+
+// Sizes and local header offset of a central directory entry.
+bool Widen(const CentralDirectoryHeader& header, const BYTE* extra,
+           std::size_t extra_size, std::uint64_t* compressed_size,
+           std::uint64_t* uncompressed_size, std::uint64_t* offset) {
+  const BYTE* ptr = nullptr;
+  std::size_t size = 0;
+  FindZip64ExtraField(extra, extra_size, &ptr, &size);
+  return Widen(header.uncompressed_size, &ptr, &size, uncompressed_size) &&
+         Widen(header.compressed_size, &ptr, &size, compressed_size) &&
+         Widen(header.relative_offset_of_local_header, &ptr, &size, offset);
+}
+
+// Reads the extra field once the file name is read, the sizes of the entry
+// come from its ZIP64 extended information if the header ones don't fit.
+bool ReadExtraField(LocalFileHeader* header, UnzipContext* ctx) {
+  auto& extra = ctx->extra;
+  extra.resize(header->extra_field_length);
+  const BYTE* ptr = nullptr;
+  std::size_t size = 0;
+  auto ok = Read(extra.data(), extra.size(), ctx);
+  if (ok) {
+    ctx->zip64 = FindZip64ExtraField(extra.data(), extra.size(), &ptr, &size);
+    ok = Widen(header->uncompressed_size, &ptr, &size,
+               &ctx->uncompressed_size) &&
+         Widen(header->compressed_size, &ptr, &size, &ctx->compressed_size);
+  }
+  if (ok) return true;
+  std::cerr << "unsupported or invalid zip file format" << std::endl;
+  return false;
+}
+
+bool Selected(LocalFileHeader* header, UnzipContext* ctx) {
+  auto filter = ctx->options->filter;
+  if (filter && !filter->Matches(ctx->name)) return false;
+  // sizes and crc follow the data if bit 3 is set
+  auto update = ctx->options->update;
+  if (!update || header->general_purpose_bit_flag & 8) return true;
+  return !update->UpToDate(ctx->filename, ctx->uncompressed_size,
+                           header->crc32, header->last_mod_file_date,
+                           header->last_mod_file_time);
+}
+
+// Waits until the sink has written everything, then indexes the files it
+// wrote for --update. After a failure none are, which ones made it to disk
+// isn't known.
+bool FlushSink(UnzipContext* ctx) {
+  auto ok = ctx->sink->Flush();
+  if (ok) {
+    for (auto& file : ctx->written)
+      ctx->options->update->Extracted(file.path.c_str(), file.size, file.crc,
+                                      file.filetime);
+  }
+  ctx->written.clear();
+  return ok;
+}
+
+// Records the digest of an extracted entry and hands it to the sink with
+// its final sizes and crc.
+bool Finish(LocalFileHeader* header, UnzipContext* ctx) {
+  auto options = ctx->options;
+  if (options->digests) {
+    BYTE digest[32];
+    if (!ctx->sha256.Finish(digest)) return false;
+    options->digests->Add(ctx->filename, digest);
+  }
+  auto& entry = ctx->entry;
+  entry.compressed_size = ctx->compressed_size;
+  entry.uncompressed_size = ctx->uncompressed_size;
+  entry.crc32 = header->crc32;
+  {
+    TraceSpan span{options->trace, "close"};
+    StageTimer timer{options->stats, Stats::Stage::kWrite};
+    if (!ctx->sink->OnEntryEnd(entry)) return false;
+  }
+  if (!entry.filetime || !options->update) return true;
+  ctx->written.push_back(WrittenFile{ctx->filename, ctx->uncompressed_size,
+                                     header->crc32, entry.filetime});
+  return ctx->written.size() < kMaxUnflushedFiles || FlushSink(ctx);
+}
+
+// Reads the data of an entry, its data descriptor too if bit 3 is set. The
+// header and context then take the crc and sizes from the descriptor.
+bool ReadData(LocalFileHeader* header, UnzipContext* ctx, uLong* crc) {
+  auto described = (header->general_purpose_bit_flag & 8) != 0;
+  auto begin = ctx->offset;
+  ctx->data_size = 0;
+  Zip64DataDescriptor descriptor{};
   switch (header->compression_method) {
     case 0:  // file is stored (no compression)
     {
-      if (header->compressed_size != header->uncompressed_size) {
+      if (described) {
+        if (!CopyToDataDescriptor(&descriptor, ctx, crc)) return false;
+        break;
+      }
+      if (ctx->compressed_size != ctx->uncompressed_size) {
         std::cerr << "unsupported or invalid zip file format" << std::endl;
         return false;
       }
-      auto size = header->uncompressed_size;
-      for (std::size_t read = 0; size && Read(size, ctx, &read) &&
-                                 Write(ctx->in, read, ctx, file.get());
-           crc = crc32(crc, ctx->in, read), size -= read)
-        ;
+      auto size = ctx->uncompressed_size;
+      PBYTE in = nullptr;
+      for (std::size_t avail = 0; size && Peek(&in, &avail, ctx) && avail;) {
+        if (size < avail) avail = static_cast<std::size_t>(size);
+        if (!Write(in, avail, ctx, crc)) return false;
+        Consume(avail, ctx);
+        size -= avail;
+      }
       if (size) return false;
       break;
     }
     case 8:  // file is deflated
     {
-      if (!Inflate(header->compressed_size, ctx, file.get(), &crc))
-        return false;
+      if (described) {
+        // the deflate stream ends the data
+        auto ok = Inflate(UINT64_MAX, ctx, crc) &&
+                  ReadDataDescriptor(ctx->offset - begin, &descriptor, ctx);
+        if (!ok) return false;
+        break;
+      }
+      auto threshold =
+          (std::min)(ctx->options->inflate_threshold, kMaxWholeSize);
+      auto whole = ctx->inflater && ctx->uncompressed_size &&
+                   ctx->compressed_size <= threshold &&
+                   ctx->uncompressed_size <= threshold;
+      auto ok = whole ? InflateBuffer(ctx, crc)
+                      : Inflate(ctx->compressed_size, ctx, crc);
+      if (!ok) return false;
+      break;
+    }
+    case 93:  // file is compressed with Zstandard
+    {
+      if (described) {
+        auto ok = Unzstd(UINT64_MAX, ctx, crc) &&
+                  ReadDataDescriptor(ctx->offset - begin, &descriptor, ctx);
+        if (!ok) return false;
+        break;
+      }
+      if (!Unzstd(ctx->compressed_size, ctx, crc)) return false;
       break;
     }
     default:
       std::cerr << "compression method is not supported" << std::endl;
       return false;
   }
-  // verify crc32
-  if (crc == header->crc32) return true;
-  std::cerr << "crc32 does not match for " << filename << ", expected "
-            << header->crc32 << ", actual " << crc << std::endl;
-  return false;
+  if (!described) return true;
+  header->crc32 = descriptor.crc32;
+  ctx->compressed_size = descriptor.compressed_size;
+  ctx->uncompressed_size = descriptor.uncompressed_size;
+  if (!ctx->central) ctx->descriptors[ctx->entry_offset] = descriptor;
+  return true;
+}
+
+// Skips an entry once its extra field is read. Skipped entries are discarded
+// in bulk, without inflating, unless only their data descriptor tells the
+// size.
+bool Discard(LocalFileHeader* header, UnzipContext* ctx) {
+  if (!(header->general_purpose_bit_flag & 8))
+    return Skip(ctx->compressed_size, ctx);
+  uLong crc = 0;
+  ctx->discard = true;
+  auto ok = ReadData(header, ctx, &crc);
+  ctx->discard = false;
+  return ok;
+}
+
+// The central directory entry of the entry being read, nullptr unless the
+// central directory was read first.
+const ArchiveEntry* FindCentral(const UnzipContext* ctx) {
+  auto central = ctx->central;
+  if (!central) return nullptr;
+  auto it = std::lower_bound(
+      central->begin(), central->end(), ctx->entry_offset,
+      [](const ArchiveEntry& entry, std::uint64_t offset) {
+        return entry.offset < offset;
+      });
+  return it != central->end() && it->offset == ctx->entry_offset ? &*it
+                                                                  : nullptr;
+}
+
+// Extracts an entry once its extra field is read.
+bool Extract(LocalFileHeader* header, UnzipContext* ctx) {
+  auto options = ctx->options;
+  TraceSpan entry_span{options->trace, "entry", ctx->filename};
+  // sizes and crc are known once the data is read if bit 3 is set, unless
+  // the central directory was read first
+  auto described = (header->general_purpose_bit_flag & 8) != 0;
+  auto central = described ? FindCentral(ctx) : nullptr;
+  auto& entry = ctx->entry;
+  entry.path = ctx->filename;
+  entry.name = ctx->name;
+  auto ch = ctx->name[header->file_name_length - 1];
+  entry.directory = ch == '/' || ch == '\\';
+  entry.method = header->compression_method;
+  entry.compressed_size = !described ? ctx->compressed_size
+                          : central  ? central->compressed_size
+                                     : EntryInfo::kUnknownSize;
+  entry.uncompressed_size = !described ? ctx->uncompressed_size
+                            : central  ? central->uncompressed_size
+                                       : EntryInfo::kUnknownSize;
+  entry.crc32 = !described ? header->crc32 : central ? central->crc32 : 0;
+  // 0 keeps the current time
+  if (!DosTimeToFileTime(header->last_mod_file_date,
+                         header->last_mod_file_time, &entry.filetime))
+    entry.filetime = 0;
+  if (entry.directory) {
+    // with bit 3 the data and its descriptor still follow, as Discard reads
+    // them, and a deflated directory holds an empty deflate stream
+    if (described && !Discard(header, ctx)) return false;
+    auto empty_stream = described && header->compression_method != 0;
+    if ((ctx->compressed_size && !empty_stream) || ctx->uncompressed_size ||
+        (described && ctx->data_size)) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;
+    }
+    StageTimer timer{options->stats, Stats::Stage::kWrite};
+    return ctx->sink->OnEntryBegin(entry) && ctx->sink->OnEntryEnd(entry);
+  }
+  if (!described && !ctx->compressed_size && ctx->uncompressed_size) {
+    std::cerr << "unsupported or invalid zip file format" << std::endl;
+    return false;
+  }
+  if (options->digests && !ctx->sha256.Initialize()) return false;
+  {
+    TraceSpan span{options->trace, "open"};
+    StageTimer timer{options->stats, Stats::Stage::kWrite};
+    if (!ctx->sink->OnEntryBegin(entry)) return false;
+  }
+  if (!described && !ctx->compressed_size) return Finish(header, ctx);
+  // the sink may take the data in place
+  ctx->view = nullptr;
+  ctx->view_end = nullptr;
+  // an entry larger than the address space can't have a view
+  if (!described && ctx->uncompressed_size <= SIZE_MAX) {
+    TraceSpan span{options->trace, "map"};
+    StageTimer timer{options->stats, Stats::Stage::kWrite};
+    if (!ctx->sink->Map(&ctx->view)) return false;
+    if (ctx->view)
+      ctx->view_end =
+          ctx->view + static_cast<std::size_t>(ctx->uncompressed_size);
+  }
+  uLong crc = 0;
+  {
+    // checksummed as it's decoded
+    auto method = header->compression_method;
+    TraceSpan span{options->trace,
+                   method == 0 ? "copy" : method == 93 ? "unzstd" : "inflate"};
+    if (!ReadData(header, ctx, &crc)) return false;
+  }
+  {
+    TraceSpan span{options->trace, "verify"};
+    // the entry may not fill its mapping, nor have the size it claims
+    if (ctx->view != ctx->view_end ||
+        (!described && ctx->data_size != ctx->uncompressed_size)) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;
+    }
+    if (central && (ctx->compressed_size != central->compressed_size ||
+                    ctx->uncompressed_size != central->uncompressed_size ||
+                    header->crc32 != central->crc32)) {
+      std::cerr << "data descriptor does not match the central directory"
+                << std::endl;
+      return false;
+    }
+    // verify crc32
+    if (crc != header->crc32) {
+      std::cerr << "crc32 does not match for " << ctx->filename
+                << ", expected " << header->crc32 << ", actual " << crc
+                << std::endl;
+      return false;
+    }
+  }
+  return Finish(header, ctx);
+}
+
+// Reads the file name and extra field following a local file header.
+bool ReadHeader(LocalFileHeader* header, UnzipContext* ctx) {
+  TraceSpan span{ctx->options->trace, "header"};
+  return ReadFileName(header, ctx) && ReadExtraField(header, ctx);
+}
+
+bool Unzip(LocalFileHeader* header, UnzipContext* ctx) {
+  if (!ReadHeader(header, ctx)) return false;
+  if (!Selected(header, ctx)) return Discard(header, ctx);
+  return Extract(header, ctx);
+}
+
+// Extracts count consecutive entries, each starting with a local file header.
+bool UnzipLocalFiles(std::size_t count, UnzipContext* ctx) {
+  for (LocalFileHeader header{}; count; --count) {
+    ctx->entry_offset = ctx->offset;
+    std::uint32_t signature = 0;
+    if (!Read(&signature, sizeof(std::uint32_t), ctx)) return false;
+    if (signature != LocalFileHeader::kSignature) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;
+    }
+    auto ok =
+        Read(&header, sizeof(LocalFileHeader), ctx) && Unzip(&header, ctx);
+    if (!ok) return false;
+  }
+  return true;
+}
+
+// Reports the extracted prefix of the archive while entries finish out of
+// order. Items are added in archive order, each covers the archive up to its
+// end and the entries before it.
+class ProgressTracker {
+ public:
+  ProgressTracker(IUnzipProgress* progress) : progress_{progress} {}
+  ProgressTracker(const ProgressTracker& other) = delete;
+  ProgressTracker(ProgressTracker&& other) = delete;
+  ProgressTracker& operator=(const ProgressTracker& other) = delete;
+  ProgressTracker& operator=(ProgressTracker&& other) = delete;
+
+  std::size_t Add(std::uint64_t end, std::uint64_t entries) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    items_.push_back(Item{end, entries, false});
+    return first_ + items_.size() - 1;
+  }
+
+  void Done(std::size_t id) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    assert(first_ <= id && id - first_ < items_.size());
+    items_[id - first_].done = true;
+    if (!items_.front().done) return;
+    Item last{};
+    for (; !items_.empty() && items_.front().done; ++first_) {
+      last = items_.front();
+      items_.pop_front();
+    }
+    // under the lock, so reports are serialized and ordered
+    progress_->Extracted(last.end, last.entries);
+  }
+
+ private:
+  struct Item {
+    std::uint64_t end;
+    std::uint64_t entries;
+    bool done;
+  };
+
+  IUnzipProgress* progress_;
+  std::mutex mutex_;
+  std::deque<Item> items_;
+  std::size_t first_{0};  // id of the front item
+};
+
+// Reports an entry extracted on the reader thread, the stream is past it.
+bool Extracted(std::uint64_t entries, UnzipContext* ctx) {
+  auto progress = ctx->progress;
+  if (!progress) return true;
+  // progress covers what is on disk, not queued writes
+  if (!FlushSink(ctx)) return false;
+  progress->Done(progress->Add(ctx->offset, entries));
+  return true;
+}
+
+// Extracts entries read ahead by Unzip(UnzipContext*) or fetched by
+// Unzip(IRangeSource*) on a pool of threads. Each job holds one or more
+// consecutive entries starting at a local file header, so workers parse them
+// exactly the way the serial path parses the stream.
+class UnzipWorkers {
+ public:
+  UnzipWorkers(UnzipOptions* options, ProgressTracker* progress)
+      : options_{options}, progress_{progress} {}
+  ~UnzipWorkers() { Finish(); }
+  UnzipWorkers(const UnzipWorkers& other) = delete;
+  UnzipWorkers(UnzipWorkers&& other) = delete;
+  UnzipWorkers& operator=(const UnzipWorkers& other) = delete;
+  UnzipWorkers& operator=(UnzipWorkers&& other) = delete;
+
+  void Start(unsigned count) {
+    assert(threads_.empty());
+    for (auto i = 0u; i < count; ++i)
+      threads_.emplace_back(&UnzipWorkers::Run, this);
+  }
+
+  // Entries are checked against central, if it was read first. Set before the
+  // first job, it outlives the workers.
+  void set_central(const std::vector<ArchiveEntry>* central) {
+    central_ = central;
+  }
+
+  // data starts at offset in the archive, id is the progress item the job
+  // completes
+  bool Push(std::vector<BYTE>&& data, std::uint64_t offset, std::size_t count,
+            std::size_t id) {
+    std::unique_lock<std::mutex> lock{mutex_};
+    // always accept a job into an empty queue, otherwise stay under the limit
+    not_full_.wait(lock, [this, &data] {
+      return failed_ || jobs_.empty() ||
+             queued_size_ + data.size() <= kMaxQueuedSize;
+    });
+    if (failed_) return false;
+    queued_size_ += data.size();
+    jobs_.push_back(Job{std::move(data), offset, count, id});
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool Finish() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      finished_ = true;
+    }
+    not_empty_.notify_all();
+    for (auto& thread : threads_) thread.join();
+    threads_.clear();
+    return !failed_;
+  }
+
+  bool failed() const { return failed_; }
+
+ private:
+  struct Job {
+    std::vector<BYTE> data;
+    std::uint64_t offset;
+    std::size_t count;  // entries
+    std::size_t id;
+  };
+
+  void Run() {
+    MemoryBytestream stream;
+    auto ctx = std::make_unique<UnzipContext>(&stream, options_);
+    // files extracted before a failure are indexed too
+    auto ok = Work(&stream, ctx.get());
+    if (FlushSink(ctx.get()) && ok) return;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      failed_ = true;
+    }
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  bool Work(MemoryBytestream* stream, UnzipContext* ctx) {
+    for (Job job;;) {
+      {
+        std::unique_lock<std::mutex> lock{mutex_};
+        not_empty_.wait(lock, [this] {
+          return failed_ || finished_ || !jobs_.empty();
+        });
+        if (failed_) return false;
+        if (jobs_.empty()) return true;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+        queued_size_ -= job.data.size();
+      }
+      not_full_.notify_one();
+      stream->Reset(job.data.data(), job.data.size());
+      ctx->offset = job.offset;
+      ctx->central = central_;
+      if (!UnzipLocalFiles(job.count, ctx)) return false;
+      if (!progress_) continue;
+      // progress covers what is on disk, not queued writes
+      if (!FlushSink(ctx)) return false;
+      progress_->Done(job.id);
+    }
+  }
+
+  UnzipOptions* options_;
+  ProgressTracker* progress_;
+  const std::vector<ArchiveEntry>* central_{nullptr};
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<Job> jobs_;
+  std::size_t queued_size_{0};
+  bool finished_{false};
+  std::atomic<bool> failed_{false};
+};
+
+// entries counts the entries up to and including this one
+bool Unzip(LocalFileHeader* header, std::uint64_t entries, UnzipContext* ctx,
+           UnzipWorkers* workers) {
+  if (!workers) return Unzip(header, ctx) && Extracted(entries, ctx);
+  auto ok = !workers->failed() && ReadHeader(header, ctx);
+  if (!ok) return false;
+  if (!Selected(header, ctx))
+    return Discard(header, ctx) && Extracted(entries, ctx);
+  // large entries are streamed on the reader thread to keep memory bounded,
+  // so are entries of unknown size
+  std::size_t name_size = header->file_name_length;
+  auto extra_size = ctx->extra.size();
+  if (header->general_purpose_bit_flag & 8 ||
+      kMaxJobSize < name_size + extra_size + ctx->compressed_size)
+    return Extract(header, ctx) && Extracted(entries, ctx);
+  auto size = static_cast<std::size_t>(ctx->compressed_size);
+  constexpr auto kHeaderSize = sizeof(std::uint32_t) + sizeof(LocalFileHeader);
+  std::vector<BYTE> data(kHeaderSize + name_size + extra_size + size);
+  auto signature = LocalFileHeader::kSignature;
+  auto ptr = data.data();
+  std::memcpy(ptr, &signature, sizeof(std::uint32_t));
+  std::memcpy(ptr + sizeof(std::uint32_t), header, sizeof(LocalFileHeader));
+  ptr += kHeaderSize;
+  std::memcpy(ptr, ctx->name, name_size);
+  ptr += name_size;
+  // the worker parses the extra field again
+  std::memcpy(ptr, ctx->extra.data(), extra_size);
+  ptr += extra_size;
+  if (!Read(ptr, size, ctx)) return false;
+  auto progress = ctx->progress;
+  auto id = progress ? progress->Add(ctx->offset, entries) : 0;
+  return workers->Push(std::move(data), ctx->entry_offset, 1, id);
 }
 
-bool Unzip(UnzipContext* ctx) {
+bool Unzip(UnzipContext* ctx, UnzipWorkers* workers) {
   assert(ctx);
   assert(ctx->stream);
   assert(ctx->options);
   // Local file header
-  int count = 0;
+  auto count = ctx->options->entries;
   std::uint32_t signature = 0;
   for (LocalFileHeader header{};; ++count) {
+    ctx->entry_offset = ctx->offset;
     if (!Read(&signature, sizeof(std::uint32_t), ctx)) return false;
     if (signature != LocalFileHeader::kSignature) break;
-    auto ok =
-        Read(&header, sizeof(LocalFileHeader), ctx) && Unzip(&header, ctx);
+    auto ok = Read(&header, sizeof(LocalFileHeader), ctx) &&
+              Unzip(&header, count + 1, ctx, workers);
     if (!ok) return false;
   }
+  if (workers && !workers->Finish()) return false;
   // Central directory
   for (CentralDirectoryHeader header{}; count; --count) {
     if (signature != CentralDirectoryHeader::kSignature) {
       std::cerr << "unsupported or invalid zip file format" << std::endl;
       return false;
     }
+    auto& extra = ctx->extra;
     auto ok = Read(&header, sizeof(CentralDirectoryHeader), ctx) &&
-              Skip(header.file_name_length, ctx) &&
-              Skip(header.extra_field_length, ctx) &&
-              Skip(header.file_comment_length, ctx) &&
-              Read(&signature, sizeof(std::uint32_t), ctx);
+              Skip(header.file_name_length, ctx);
     if (!ok) return false;
+    extra.resize(header.extra_field_length);
+    std::uint64_t compressed_size = 0;
+    std::uint64_t uncompressed_size = 0;
+    std::uint64_t offset = 0;
+    ok = Read(extra.data(), extra.size(), ctx) &&
+         Widen(header, extra.data(), extra.size(), &compressed_size,
+               &uncompressed_size, &offset);
+    if (!ok) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;
+    }
+    // entries delimited by their data descriptor alone are checked again
+    auto it = ctx->descriptors.find(offset);
+    if (it != ctx->descriptors.end() &&
+        (it->second.crc32 != header.crc32 ||
+         it->second.compressed_size != compressed_size ||
+         it->second.uncompressed_size != uncompressed_size)) {
+      std::cerr << "data descriptor does not match the central directory"
+                << std::endl;
+      return false;
+    }
+    ok = Skip(header.file_comment_length, ctx) &&
+         Read(&signature, sizeof(std::uint32_t), ctx);
+    if (!ok) return false;
+  }
+  // Zip64 end of central directory record and locator
+  if (signature == Zip64EndOfCentralDirectoryRecord::kSignature) {
+    // the size field doesn't count itself
+    constexpr auto kFixedSize =
+        sizeof(Zip64EndOfCentralDirectoryRecord) - sizeof(std::uint64_t);
+    Zip64EndOfCentralDirectoryRecord record{};
+    Zip64EndOfCentralDirectoryLocator locator{};
+    auto ok =
+        Read(&record, sizeof(Zip64EndOfCentralDirectoryRecord), ctx) &&
+        kFixedSize <= record.size_of_zip64_end_of_central_directory_record &&
+        Skip(record.size_of_zip64_end_of_central_directory_record - kFixedSize,
+             ctx) &&
+        Read(&signature, sizeof(std::uint32_t), ctx) &&
+        signature == Zip64EndOfCentralDirectoryLocator::kSignature &&
+        Read(&locator, sizeof(Zip64EndOfCentralDirectoryLocator), ctx) &&
+        Read(&signature, sizeof(std::uint32_t), ctx);
+    if (!ok) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;
+    }
   }
   // End of central directory record
   if (signature != EndOfCentralDirectoryRecord::kSignature) {
     std::cerr << "unsupported or invalid zip file format" << std::endl;
     return false;
   }
-  std::size_t read = 0;
+  PBYTE trailing = nullptr;
+  std::size_t trailing_size = 0;
   EndOfCentralDirectoryRecord record{};
   auto ok = Read(&record, sizeof(EndOfCentralDirectoryRecord), ctx) &&
-            Skip(record.zip_file_comment_length, ctx) && Read(1, ctx, &read);
+            Skip(record.zip_file_comment_length, ctx) &&
+            Peek(&trailing, &trailing_size, ctx);
   if (!ok) return false;
-  if (read == 0) return true;
+  if (trailing_size == 0) return true;
   std::cerr << "unsupported or invalid zip file format" << std::endl;
   return false;
 }
 
+// Consecutive entries fetched with one range request, or a single large
+// entry streamed on its own
+struct EntryGroup {
+  std::uint64_t offset;
+  std::uint64_t size;
+  std::size_t count;
+  std::uint64_t entries;  // in the archive up to the end of the group
+  bool large;
+};
+
+// Reads the Zip64 end of central directory record at offset, from the tail
+// if it holds it.
+bool ReadZip64Record(IRangeSource* source, std::uint64_t offset,
+                     std::uint64_t tail_offset, const std::vector<BYTE>& tail,
+                     Zip64EndOfCentralDirectoryRecord* record) {
+  constexpr auto kSize =
+      sizeof(std::uint32_t) + sizeof(Zip64EndOfCentralDirectoryRecord);
+  std::vector<BYTE> data;
+  const BYTE* ptr = nullptr;
+  if (tail_offset <= offset && offset + kSize <= tail_offset + tail.size()) {
+    ptr = tail.data() + (offset - tail_offset);
+  } else {
+    std::size_t tag = 0;
+    auto ok = source->Request(offset, kSize, 0) && source->Wait(&tag, &data) &&
+              kSize <= data.size();
+    if (!ok) return false;
+    ptr = data.data();
+  }
+  std::uint32_t signature = 0;
+  std::memcpy(&signature, ptr, sizeof(std::uint32_t));
+  if (signature == Zip64EndOfCentralDirectoryRecord::kSignature) {
+    std::memcpy(record, ptr + sizeof(std::uint32_t),
+                sizeof(Zip64EndOfCentralDirectoryRecord));
+    return true;
+  }
+  std::cerr << "unsupported or invalid zip file format" << std::endl;
+  return false;
+}
+
+bool ReadCentralDirectory(IRangeSource* source, UnzipOptions* options,
+                          std::vector<ArchiveEntry>* entries) {
+  std::uint64_t tail_offset = 0;
+  std::vector<BYTE> tail;
+  if (!source->ReadTail(&tail_offset, &tail)) return false;
+  // End of central directory record, only the comment may follow it
+  constexpr auto kRecordSize =
+      sizeof(std::uint32_t) + sizeof(EndOfCentralDirectoryRecord);
+  EndOfCentralDirectoryRecord record{};
+  auto found = false;
+  auto end = tail.size();
+  for (; !found && kRecordSize <= end; --end) {
+    auto ptr = tail.data() + end - kRecordSize;
+    std::uint32_t signature = 0;
+    std::memcpy(&signature, ptr, sizeof(std::uint32_t));
+    if (signature != EndOfCentralDirectoryRecord::kSignature) continue;
+    std::memcpy(&record, ptr + sizeof(std::uint32_t),
+                sizeof(EndOfCentralDirectoryRecord));
+    found = end + record.zip_file_comment_length == tail.size();
+  }
+  std::uint64_t offset =
+      record
+          .offset_of_start_of_central_directory_with_respect_to_the_starting_disk_number;
+  std::uint64_t size = record.size_of_the_central_directory;
+  std::uint64_t count = record.total_number_of_entries_in_the_central_directory;
+  // the Zip64 end of central directory locator precedes the record of ZIP64
+  // archives and points to the Zip64 end of central directory record
+  constexpr auto kLocatorSize =
+      sizeof(std::uint32_t) + sizeof(Zip64EndOfCentralDirectoryLocator);
+  auto record_begin = end + 1 - kRecordSize;  // the loop went one past it
+  if (found && kLocatorSize <= record_begin) {
+    auto ptr = tail.data() + record_begin - kLocatorSize;
+    std::uint32_t signature = 0;
+    std::memcpy(&signature, ptr, sizeof(std::uint32_t));
+    if (signature == Zip64EndOfCentralDirectoryLocator::kSignature) {
+      Zip64EndOfCentralDirectoryLocator locator{};
+      std::memcpy(&locator, ptr + sizeof(std::uint32_t),
+                  sizeof(Zip64EndOfCentralDirectoryLocator));
+      Zip64EndOfCentralDirectoryRecord zip64{};
+      if (!ReadZip64Record(
+              source,
+              locator.relative_offset_of_the_zip64_end_of_central_directory_record,
+              tail_offset, tail, &zip64))
+        return false;
+      offset =
+          zip64
+              .offset_of_start_of_central_directory_with_respect_to_the_starting_disk_number;
+      size = zip64.size_of_the_central_directory;
+      count = zip64.total_number_of_entries_in_the_central_directory;
+    }
+  }
+  if (!found || tail_offset + tail.size() < offset + size) {
+    std::cerr << "unsupported or invalid zip file format" << std::endl;
+    return false;
+  }
+  // Central directory, read it separately unless the tail holds it
+  std::vector<BYTE> data;
+  PBYTE ptr = nullptr;
+  if (tail_offset <= offset) {
+    ptr = tail.data() + (offset - tail_offset);
+  } else {
+    std::size_t tag = 0;
+    auto ok = source->Request(offset, static_cast<std::size_t>(size), 0) &&
+              source->Wait(&tag, &data);
+    if (!ok) return false;
+    ptr = data.data();
+  }
+  MemoryBytestream stream;
+  stream.Reset(ptr, static_cast<std::size_t>(size));
+  std::string name;
+  std::vector<BYTE> extra;
+  std::string path;  // in the destination directory
+  for (CentralDirectoryHeader header{}; count; --count) {
+    std::uint32_t signature = 0;
+    std::uint64_t compressed_size = 0;
+    std::uint64_t uncompressed_size = 0;
+    std::uint64_t entry_offset = 0;
+    auto ok = Read(&stream, &signature, sizeof(std::uint32_t)) &&
+              signature == CentralDirectoryHeader::kSignature &&
+              Read(&stream, &header, sizeof(CentralDirectoryHeader));
+    if (ok) {
+      name.resize(header.file_name_length);
+      extra.resize(header.extra_field_length);
+      ok = Read(&stream, &name[0], name.size()) &&
+           Read(&stream, extra.data(), extra.size()) &&
+           Skip(&stream, header.file_comment_length) &&
+           Widen(header, extra.data(), extra.size(), &compressed_size,
+                 &uncompressed_size, &entry_offset);
+    }
+    if (!ok) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;
+    }
+    // the size of a skipped entry still bounds the one before it
+    auto filter = options->filter;
+    auto selected = !filter || filter->Matches(name.c_str());
+    auto update = options->update;
+    if (selected && update) {
+      path = options->directory ? options->directory : "";
+      path += name;
+      selected = !update->UpToDate(path.c_str(), uncompressed_size,
+                                   header.crc32, header.last_mod_file_date,
+                                   header.last_mod_file_time);
+    }
+    entries->push_back(ArchiveEntry{entry_offset, 0, compressed_size,
+                                    uncompressed_size, header.crc32,
+                                    selected});
+  }
+  // the central directory doesn't have to follow the archive order
+  std::sort(entries->begin(), entries->end(),
+            [](const ArchiveEntry& a, const ArchiveEntry& b) {
+              return a.offset < b.offset;
+            });
+  for (auto it = entries->begin(); it != entries->end(); ++it) {
+    auto next =
+        std::next(it) == entries->end() ? offset : std::next(it)->offset;
+    constexpr auto kHeaderSize =
+        sizeof(std::uint32_t) + sizeof(LocalFileHeader);
+    if (next < it->offset + kHeaderSize + it->compressed_size) {
+      std::cerr << "unsupported or invalid zip file format" << std::endl;
+      return false;
+    }
+    it->size = next - it->offset;
+  }
+  return true;
+}
+
+// Reads the central directory into entries and extracts what it selects.
+// Workers check entries against it, so entries outlive them.
+bool Unzip(IRangeSource* source, UnzipContext* ctx, UnzipWorkers* workers,
+           std::vector<ArchiveEntry>* entries) {
+  if (!ReadCentralDirectory(source, ctx->options, entries)) return false;
+  ctx->central = entries;
+  workers->set_central(entries);
+  // neighbouring small entries share a request, large ones are streamed after
+  // the rest, skipped and already extracted ones are never requested
+  std::vector<EntryGroup> groups;
+  for (std::size_t i = 0; i < entries->size(); ++i) {
+    auto& entry = (*entries)[i];
+    if (!entry.selected || entry.offset < ctx->options->offset) continue;
+    auto large = kMaxJobSize < entry.size;
+    if (!large && !groups.empty()) {
+      auto& group = groups.back();
+      if (!group.large && group.offset + group.size == entry.offset &&
+          group.size + entry.size <= kRangeSize) {
+        group.size += entry.size;
+        ++group.count;
+        group.entries = i + 1;
+        continue;
+      }
+    }
+    groups.push_back(EntryGroup{entry.offset, entry.size, 1, i + 1, large});
+  }
+  // progress ids match group indices
+  auto progress = ctx->progress;
+  if (progress)
+    for (auto& group : groups)
+      progress->Add(group.offset + group.size, group.entries);
+  // keep requests in flight while the workers extract what arrived
+  std::size_t next = 0;
+  std::size_t requested = 0;
+  std::size_t requested_size = 0;
+  while (next < groups.size() || requested) {
+    for (; next < groups.size(); ++next) {
+      auto& group = groups[next];
+      if (group.large) continue;
+      auto size = static_cast<std::size_t>(group.size);
+      if (requested && kMaxQueuedSize < requested_size + size) break;
+      if (!source->Request(group.offset, size, next)) return false;
+      requested_size += size;
+      ++requested;
+    }
+    if (!requested) break;
+    std::size_t tag = 0;
+    std::vector<BYTE> data;
+    if (!source->Wait(&tag, &data)) return false;
+    --requested;
+    requested_size -= data.size();
+    auto& group = groups[tag];
+    if (!workers->Push(std::move(data), group.offset, group.count, tag))
+      return false;
+  }
+  for (std::size_t i = 0; i < groups.size(); ++i) {
+    auto& group = groups[i];
+    if (!group.large) continue;
+    auto stream = source->Stream(group.offset, group.size);
+    if (!stream) return false;
+    ctx->stream = stream.get();
+    ctx->offset = group.offset;
+    if (!UnzipLocalFiles(1, ctx)) return false;
+    if (!progress) continue;
+    if (!FlushSink(ctx)) return false;
+    progress->Done(i);
+  }
+  return FlushSink(ctx) && workers->Finish();
+}
+
 }  // namespace
 
 bool Unzip(IBytestream* stream, UnzipOptions* options) {
-  return Unzip(std::make_unique<UnzipContext>(stream, options).get());
+  std::unique_ptr<ProgressTracker> progress;
+  if (options->progress)
+    progress = std::make_unique<ProgressTracker>(options->progress);
+  // the context goes first, workers may wait for what its sink holds
+  std::unique_ptr<UnzipWorkers> workers;
+  if (options->threads) {
+    workers = std::make_unique<UnzipWorkers>(options, progress.get());
+    workers->Start(options->threads);
+  }
+  auto ctx = std::make_unique<UnzipContext>(stream, options);
+  ctx->progress = progress.get();
+  auto ok = Unzip(ctx.get(), workers.get());
+  return FlushSink(ctx.get()) && ok;
+}
+
+bool Unzip(IRangeSource* source, UnzipOptions* options) {
+  std::unique_ptr<ProgressTracker> progress;
+  if (options->progress)
+    progress = std::make_unique<ProgressTracker>(options->progress);
+  std::vector<ArchiveEntry> entries;  // goes after the workers
+  UnzipWorkers workers{options, progress.get()};
+  workers.Start((std::max)(options->threads, 1u));
+  // the context goes first, workers may wait for what its sink holds
+  auto ctx = std::make_unique<UnzipContext>(nullptr, options);
+  ctx->progress = progress.get();
+  auto ok = Unzip(source, ctx.get(), &workers, &entries);
+  return FlushSink(ctx.get()) && ok;
 }
\ No newline at end of file
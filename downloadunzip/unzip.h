@@ -1,8 +1,43 @@
 #pragma once
+#include "entry_sink.h"
+#include "inflate_engine.h"
+
+class DigestList;
+class EntryFilter;
+class Stats;
+class Trace;
+class UpdateIndex;
+
+// Learns how far extraction got, so that an interrupted run can resume.
+struct IUnzipProgress {
+  // The archive up to offset is extracted, entries counts the entries in it.
+  // Calls are serialized and never go backwards.
+  virtual void Extracted(std::uint64_t offset, std::uint64_t entries) = 0;
+};
 
 struct UnzipOptions {
-  bool overwrite;
-  bool dryrun;
+  IEntrySinkFactory* sinks;  // where extracted entries go
+  unsigned threads;  // worker threads, 0 means extract on the calling thread
+  InflateBackend inflate;
+  // kBuffer inflates entries up to this size, compressed and not, in one call
+  std::size_t inflate_threshold;
+  // prefixed to entry names, ends with a slash, nullptr means the current
+  // directory
+  PCSTR directory;
+  // entries to extract, nullptr means all of them
+  const EntryFilter* filter;
+  // skips entries with an up to date local copy, nullptr rewrites them all
+  UpdateIndex* update;
+  DigestList* digests;  // of extracted entries, nullptr if not needed
+  // where a resumed stream starts in the archive and the entries before it
+  std::uint64_t offset;
+  std::uint64_t entries;
+  IUnzipProgress* progress;  // nullptr if not needed
+  Stats* stats;              // counts the stages, nullptr if not needed
+  Trace* trace;              // records entry spans, nullptr if not needed
 };
 
-bool Unzip(IBytestream* stream, UnzipOptions* options);
\ No newline at end of file
+bool Unzip(IBytestream* stream, UnzipOptions* options);
+// Lets the central directory drive extraction, entries are fetched with
+// concurrent range requests and extracted as they arrive.
+bool Unzip(IRangeSource* source, UnzipOptions* options);
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "stdafx.h"
+
+#include "update_index.h"
+
+#include "crc32.h"
+
+namespace {
+
+constexpr std::size_t kChunkSize = 0x10000;  // 64 KiB
+
+inline std::uint64_t ToUInt64(const FILETIME& filetime) {
+  return (static_cast<std::uint64_t>(filetime.dwHighDateTime) << 32) |
+         filetime.dwLowDateTime;
+}
+
+bool Crc32File(PCSTR path, std::uint32_t* crc) {
+  using file_t = std::unique_ptr<void, decltype(&CloseHandle)>;
+  auto handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (handle == INVALID_HANDLE_VALUE) return false;
+  auto file = file_t{handle, CloseHandle};
+  auto buffer = std::make_unique<BYTE[]>(kChunkSize);
+  std::uint32_t value = 0;
+  for (DWORD read = 0;;) {
+    if (!ReadFile(file.get(), buffer.get(), kChunkSize, &read, NULL))
+      return false;
+    if (!read) break;
+    value = Crc32(value, buffer.get(), read);
+  }
+  *crc = value;
+  return true;
+}
+
+}  // namespace
+
+bool DosTimeToFileTime(std::uint16_t date, std::uint16_t time,
+                       std::uint64_t* filetime) {
+  FILETIME local{};
+  FILETIME utc{};
+  if (!DosDateTimeToFileTime(date, time, &local) ||
+      !LocalFileTimeToFileTime(&local, &utc))
+    return false;
+  *filetime = ToUInt64(utc);
+  return true;
+}
+
+bool UpdateIndex::Initialize(PCSTR path) {
+  assert(!path_);
+  path_ = path;
+  auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    if (error == ERROR_FILE_NOT_FOUND) return true;  // first run
+    std::cerr << "error opening index file " << path << " (code " << error
+              << ')' << std::endl;
+    return false;
+  }
+  using file_t = std::unique_ptr<void, decltype(&CloseHandle)>;
+  auto guard = file_t{file, CloseHandle};
+  std::string text;
+  char buffer[0x1000];
+  for (DWORD read = 0; ReadFile(file, buffer, sizeof(buffer), &read, NULL) &&
+                       read;)
+    text.append(buffer, read);
+  // one "crc size filetime name" line per file, unreadable lines are ignored
+  for (std::size_t pos = 0; pos < text.size();) {
+    auto end = text.find('\n', pos);
+    if (end == std::string::npos) end = text.size();
+    auto line = text.substr(pos, end - pos);
+    pos = end + 1;
+    PSTR ptr = &line[0];
+    Item item{};
+    item.crc = static_cast<std::uint32_t>(strtoul(ptr, &ptr, 16));
+    item.size = strtoull(ptr, &ptr, 10);
+    item.filetime = strtoull(ptr, &ptr, 10);
+    if (*ptr != ' ' || !ptr[1]) continue;
+    items_[ptr + 1] = item;
+  }
+  return true;
+}
+
+bool UpdateIndex::UpToDate(PCSTR name, std::uint64_t size, std::uint32_t crc,
+                           std::uint16_t date, std::uint16_t time) {
+  WIN32_FILE_ATTRIBUTE_DATA data{};
+  if (!GetFileAttributesExA(name, GetFileExInfoStandard, &data)) return false;
+  if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) return false;
+  auto file_size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) |
+                   data.nFileSizeLow;
+  auto filetime = ToUInt64(data.ftLastWriteTime);
+  std::uint64_t entry_filetime = 0;
+  if (file_size != size || !DosTimeToFileTime(date, time, &entry_filetime))
+    return false;
+  if (filetime != entry_filetime) return false;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto it = items_.find(name);
+    if (it != items_.end() && it->second.size == size &&
+        it->second.filetime == filetime)
+      return it->second.crc == crc;
+  }
+  // not indexed yet, hash the local copy once
+  std::uint32_t file_crc = 0;
+  if (!Crc32File(name, &file_crc)) return false;
+  Extracted(name, size, file_crc, filetime);
+  return file_crc == crc;
+}
+
+void UpdateIndex::Extracted(PCSTR name, std::uint64_t size, std::uint32_t crc,
+                            std::uint64_t filetime) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  items_[name] = Item{size, filetime, crc};
+  dirty_ = true;
+}
+
+bool UpdateIndex::Save() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!dirty_) return true;
+  std::string text;
+  char line[64];
+  for (auto& it : items_) {
+    auto& item = it.second;
+    snprintf(line, sizeof(line), "%08x %llu %llu ", item.crc,
+             static_cast<unsigned long long>(item.size),
+             static_cast<unsigned long long>(item.filetime));
+    text += line;
+    text += it.first;
+    text += '\n';
+  }
+  // replace the old index only once the new one is complete
+  auto temp = std::string{path_} + ".tmp";
+  auto file = CreateFileA(temp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                          FILE_ATTRIBUTE_NORMAL, NULL);
+  auto ok = file != INVALID_HANDLE_VALUE;
+  if (ok) {
+    DWORD written = 0;
+    ok = WriteFile(file, text.data(), static_cast<DWORD>(text.size()),
+                   &written, NULL) &&
+         written == text.size();
+    CloseHandle(file);
+    ok = ok && MoveFileExA(temp.c_str(), path_, MOVEFILE_REPLACE_EXISTING);
+  }
+  if (ok) {
+    dirty_ = false;
+    return true;
+  }
+  std::cerr << "error writing index file " << path_ << " (code "
+            << GetLastError() << ')' << std::endl;
+  return false;
+}
\ No newline at end of file
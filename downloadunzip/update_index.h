@@ -0,0 +1,39 @@
+#pragma once
+
+// Converts a DOS date and time, local time as stored in zip headers, to a
+// UTC FILETIME value.
+bool DosTimeToFileTime(std::uint16_t date, std::uint16_t time,
+                       std::uint64_t* filetime);
+
+// Tells which entries have an up to date local copy, --update mode. A local
+// file is up to date if its size and modification time match the entry and so
+// does its CRC. CRCs of local files are kept in a sidecar index, so unchanged
+// files are not read again on the next run.
+class UpdateIndex {
+ public:
+  UpdateIndex() = default;
+  UpdateIndex(const UpdateIndex& other) = delete;
+  UpdateIndex(UpdateIndex&& other) = delete;
+  UpdateIndex& operator=(const UpdateIndex& other) = delete;
+  UpdateIndex& operator=(UpdateIndex&& other) = delete;
+
+  bool Initialize(PCSTR path);
+  // Safe to call from several threads.
+  bool UpToDate(PCSTR name, std::uint64_t size, std::uint32_t crc,
+                std::uint16_t date, std::uint16_t time);
+  void Extracted(PCSTR name, std::uint64_t size, std::uint32_t crc,
+                 std::uint64_t filetime);
+  bool Save();
+
+ private:
+  struct Item {
+    std::uint64_t size;
+    std::uint64_t filetime;
+    std::uint32_t crc;
+  };
+
+  PCSTR path_{nullptr};
+  std::mutex mutex_;
+  std::unordered_map<std::string, Item> items_;
+  bool dirty_{false};
+};
\ No newline at end of file
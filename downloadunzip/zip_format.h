@@ -0,0 +1,113 @@
+#pragma once
+// https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+
+#pragma pack(push, 2)
+
+// Local file header
+struct alignas(2) LocalFileHeader {
+  static constexpr std::uint32_t kSignature = 0x04034b50;
+  std::uint16_t version_needed_to_extract;
+  std::uint16_t general_purpose_bit_flag;
+  std::uint16_t compression_method;
+  std::uint16_t last_mod_file_time;
+  std::uint16_t last_mod_file_date;
+  std::uint32_t crc32;
+  std::uint32_t compressed_size;
+  std::uint32_t uncompressed_size;
+  std::uint16_t file_name_length;
+  std::uint16_t extra_field_length;
+  // (variable size) file name
+  // (variable size) extra field
+};
+
+// Data descriptor, follows the data if bit 3 of general purpose bit flag is
+// set, with or without the signature
+struct alignas(2) DataDescriptor {
+  static constexpr std::uint32_t kSignature = 0x08074b50;
+  std::uint32_t crc32;
+  std::uint32_t compressed_size;
+  std::uint32_t uncompressed_size;
+};
+
+// Data descriptor of an entry with ZIP64 extended information
+struct alignas(2) Zip64DataDescriptor {
+  std::uint32_t crc32;
+  std::uint64_t compressed_size;
+  std::uint64_t uncompressed_size;
+};
+
+// Extra field block, blocks follow each other in the extra field
+struct alignas(2) ExtraFieldHeader {
+  // ZIP64 extended information, 8 byte values of the header fields that are
+  // all ones, in the order uncompressed size, compressed size, relative
+  // offset of local header, 4 byte disk number start
+  static constexpr std::uint16_t kZip64Tag = 0x0001;
+  std::uint16_t tag;
+  std::uint16_t size;
+  // (variable size) data
+};
+
+// Central directory header
+struct alignas(2) CentralDirectoryHeader {
+  static constexpr std::uint32_t kSignature = 0x02014b50;
+  std::uint16_t version_made_by;
+  std::uint16_t version_needed_to_extract;
+  std::uint16_t general_purpose_bit_flag;
+  std::uint16_t compression_method;
+  std::uint16_t last_mod_file_time;
+  std::uint16_t last_mod_file_date;
+  std::uint32_t crc32;
+  std::uint32_t compressed_size;
+  std::uint32_t uncompressed_size;
+  std::uint16_t file_name_length;
+  std::uint16_t extra_field_length;
+  std::uint16_t file_comment_length;
+  std::uint16_t disk_number_start;
+  std::uint16_t internal_file_attributes;
+  std::uint32_t external_file_attributes;
+  std::uint32_t relative_offset_of_local_header;
+  // (variable size) file name
+  // (variable size) extra field
+  // (variable size) file comment
+};
+
+// Zip64 end of central directory record
+struct alignas(2) Zip64EndOfCentralDirectoryRecord {
+  static constexpr std::uint32_t kSignature = 0x06064b50;
+  std::uint64_t size_of_zip64_end_of_central_directory_record;
+  std::uint16_t version_made_by;
+  std::uint16_t version_needed_to_extract;
+  std::uint32_t number_of_this_disk;
+  std::uint32_t number_of_the_disk_with_the_start_of_the_central_directory;
+  std::uint64_t total_number_of_entries_in_the_central_directory_on_this_disk;
+  std::uint64_t total_number_of_entries_in_the_central_directory;
+  std::uint64_t size_of_the_central_directory;
+  std::uint64_t
+      offset_of_start_of_central_directory_with_respect_to_the_starting_disk_number;
+  // (variable size) zip64 extensible data sector
+};
+
+// Zip64 end of central directory locator
+struct alignas(2) Zip64EndOfCentralDirectoryLocator {
+  static constexpr std::uint32_t kSignature = 0x07064b50;
+  std::uint32_t
+      number_of_the_disk_with_the_start_of_the_zip64_end_of_central_directory;
+  std::uint64_t relative_offset_of_the_zip64_end_of_central_directory_record;
+  std::uint32_t total_number_of_disks;
+};
+
+// End of central directory record
+struct alignas(2) EndOfCentralDirectoryRecord {
+  static constexpr std::uint32_t kSignature = 0x06054b50;
+  std::uint16_t number_of_this_disk;
+  std::uint16_t number_of_the_disk_with_the_start_of_the_central_directory;
+  std::uint16_t total_number_of_entries_in_the_central_directory_on_this_disk;
+  std::uint16_t total_number_of_entries_in_the_central_directory;
+  std::uint32_t size_of_the_central_directory;
+  std::uint32_t
+      offset_of_start_of_central_directory_with_respect_to_the_starting_disk_number;
+  std::uint16_t zip_file_comment_length;
+  // (variable size) zip_file_comment;
+};
+
+#pragma pack(pop)
\ No newline at end of file